@@ -31,7 +31,7 @@
 #define SO_PRIORITY	12
 #define SO_LINGER	13
 #define SO_BSDCOMPAT	14
-/* To add :#define SO_REUSEPORT 15 */
+#define SO_REUSEPORT	15
 #define SO_PASSCRED	16
 #define SO_PEERCRED	17
 #define SO_RCVLOWAT	18
@@ -71,4 +71,8 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_BUSY_POLL		41
+
+#define SO_ZEROCOPY		42
+
 #endif /* _ASM_IA64_SOCKET_H */
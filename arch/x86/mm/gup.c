@@ -124,6 +124,12 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 
 	refs = 0;
 	head = pte_page(pte);
+	/*
+	 * Anonymous transparent hugepages must be split before they
+	 * can be pinned, leave them to the get_user_pages() slowpath.
+	 */
+	if (PageAnon(head))
+		return 0;
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
 	do {
 		VM_BUG_ON(compound_head(page) != head);
@@ -1565,6 +1565,9 @@ static int igb_clean_test_rings(struct igb_ring *rx_ring,
 	rx_ring->next_to_clean = rx_ntc;
 	tx_ring->next_to_clean = tx_ntc;
 
+	/* the test frames were reclaimed without reporting completions */
+	netdev_tx_reset_queue(txring_txq(tx_ring));
+
 	return count;
 }
 
@@ -2699,6 +2699,8 @@ static void igb_clean_tx_ring(struct igb_ring *tx_ring)
 
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
+
+	netdev_tx_reset_queue(txring_txq(tx_ring));
 }
 
 /**
@@ -3794,6 +3796,7 @@ netdev_tx_t igb_xmit_frame_ring_adv(struct sk_buff *skb,
 		return NETDEV_TX_OK;
 	}
 
+	netdev_tx_sent_queue(txring_txq(tx_ring), skb->len);
 	igb_tx_queue_adv(tx_ring, tx_flags, count, skb->len, hdr_len);
 
 	/* Make sure there is space in the ring for the next send. */
@@ -4912,6 +4915,7 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 	struct sk_buff *skb;
 	union e1000_adv_tx_desc *tx_desc, *eop_desc;
 	unsigned int total_bytes = 0, total_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 	unsigned int i, eop, count = 0;
 	bool cleaned = false;
 
@@ -4936,6 +4940,8 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 					    skb->len;
 				total_packets += segs;
 				total_bytes += bytecount;
+				pkts_compl++;
+				bytes_compl += skb->len;
 
 				igb_tx_hwtstamp(q_vector, skb);
 			}
@@ -4953,6 +4959,8 @@ static bool igb_clean_tx_irq(struct igb_q_vector *q_vector)
 
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(txring_txq(tx_ring), pkts_compl, bytes_compl);
+
 	if (unlikely(count &&
 		     netif_carrier_ok(netdev) &&
 		     igb_desc_unused(tx_ring) >= IGB_TX_QUEUE_WAKE)) {
@@ -355,6 +355,7 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 	struct ixgbe_tx_buffer *tx_buffer_info;
 	unsigned int i, eop, count = 0;
 	unsigned int total_bytes = 0, total_packets = 0;
+	unsigned int bytes_compl = 0, pkts_compl = 0;
 
 	i = tx_ring->next_to_clean;
 	eop = tx_ring->tx_buffer_info[i].next_to_watch;
@@ -392,6 +393,8 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 				bytecount = ((segs - 1) * hlen) + skb->len;
 				total_packets += segs;
 				total_bytes += bytecount;
+				pkts_compl++;
+				bytes_compl += skb->len;
 			}
 
 			ixgbe_unmap_and_free_tx_resource(adapter,
@@ -410,6 +413,10 @@ static bool ixgbe_clean_tx_irq(struct ixgbe_q_vector *q_vector,
 
 	tx_ring->next_to_clean = i;
 
+	netdev_tx_completed_queue(netdev_get_tx_queue(netdev,
+						      tx_ring->queue_index),
+				  pkts_compl, bytes_compl);
+
 #define TX_WAKE_THRESHOLD (DESC_NEEDED * 2)
 	if (unlikely(count && netif_carrier_ok(netdev) &&
 	             (IXGBE_DESC_UNUSED(tx_ring) >= TX_WAKE_THRESHOLD))) {
@@ -571,7 +578,14 @@ static void ixgbe_receive_skb(struct ixgbe_q_vector *q_vector,
 	u16 tag = le16_to_cpu(rx_desc->wb.upper.vlan);
 
 	skb_record_rx_queue(skb, ring->queue_index);
-	if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL)) {
+	skb_mark_napi_id(skb, napi);
+	if (ixgbe_qv_ll_polling(q_vector)) {
+		/* a busy polling socket is waiting, don't hold it in GRO */
+		if (adapter->vlgrp && is_vlan && (tag & VLAN_VID_MASK))
+			vlan_hwaccel_receive_skb(skb, adapter->vlgrp, tag);
+		else
+			netif_receive_skb(skb);
+	} else if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL)) {
 		if (adapter->vlgrp && is_vlan && (tag & VLAN_VID_MASK))
 			vlan_gro_receive(napi, adapter->vlgrp, tag, skb);
 		else
@@ -1424,6 +1438,9 @@ static int ixgbe_clean_rxonly(struct napi_struct *napi, int budget)
 	int work_done = 0;
 	long r_idx;
 
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 	r_idx = find_first_bit(q_vector->rxr_idx, adapter->num_rx_queues);
 	rx_ring = &(adapter->rx_ring[r_idx]);
 #ifdef CONFIG_IXGBE_DCA
@@ -1433,6 +1450,8 @@ static int ixgbe_clean_rxonly(struct napi_struct *napi, int budget)
 
 	ixgbe_clean_rx_irq(q_vector, rx_ring, &work_done, budget);
 
+	ixgbe_qv_unlock_napi(q_vector);
+
 	/* If all Rx work done, exit the polling mode */
 	if (work_done < budget) {
 		napi_complete(napi);
@@ -1464,6 +1483,9 @@ static int ixgbe_clean_rxtx_many(struct napi_struct *napi, int budget)
 	long r_idx;
 	bool tx_clean_complete = true;
 
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 	r_idx = find_first_bit(q_vector->txr_idx, adapter->num_tx_queues);
 	for (i = 0; i < q_vector->txr_count; i++) {
 		ring = &(adapter->tx_ring[r_idx]);
@@ -1492,6 +1514,8 @@ static int ixgbe_clean_rxtx_many(struct napi_struct *napi, int budget)
 		                      r_idx + 1);
 	}
 
+	ixgbe_qv_unlock_napi(q_vector);
+
 	r_idx = find_first_bit(q_vector->rxr_idx, adapter->num_rx_queues);
 	ring = &(adapter->rx_ring[r_idx]);
 	/* If all Rx work done, exit the polling mode */
@@ -2479,6 +2503,7 @@ static void ixgbe_napi_enable_all(struct ixgbe_adapter *adapter)
 			}
 		}
 
+		ixgbe_qv_init_lock(q_vector);
 		napi_enable(napi);
 	}
 }
@@ -2496,6 +2521,9 @@ static void ixgbe_napi_disable_all(struct ixgbe_adapter *adapter)
 	for (q_idx = 0; q_idx < q_vectors; q_idx++) {
 		q_vector = adapter->q_vector[q_idx];
 		napi_disable(&q_vector->napi);
+		/* keep busy polling sockets out until napi is enabled again */
+		while (!ixgbe_qv_lock_napi(q_vector))
+			msleep(1);
 	}
 }
 
@@ -3014,6 +3042,9 @@ static void ixgbe_clean_tx_ring(struct ixgbe_adapter *adapter,
 	tx_ring->next_to_use = 0;
 	tx_ring->next_to_clean = 0;
 
+	netdev_tx_reset_queue(netdev_get_tx_queue(adapter->netdev,
+						  tx_ring->queue_index));
+
 	if (tx_ring->head)
 		writel(0, adapter->hw.hw_addr + tx_ring->head);
 	if (tx_ring->tail)
@@ -3119,6 +3150,9 @@ static int ixgbe_poll(struct napi_struct *napi, int budget)
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 	int tx_clean_complete, work_done = 0;
 
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
 #ifdef CONFIG_IXGBE_DCA
 	if (adapter->flags & IXGBE_FLAG_DCA_ENABLED) {
 		ixgbe_update_tx_dca(adapter, adapter->tx_ring);
@@ -3129,6 +3163,8 @@ static int ixgbe_poll(struct napi_struct *napi, int budget)
 	tx_clean_complete = ixgbe_clean_tx_irq(q_vector, adapter->tx_ring);
 	ixgbe_clean_rx_irq(q_vector, adapter->rx_ring, &work_done, budget);
 
+	ixgbe_qv_unlock_napi(q_vector);
+
 	if (!tx_clean_complete)
 		work_done = budget;
 
@@ -3143,6 +3179,47 @@ static int ixgbe_poll(struct napi_struct *napi, int budget)
 	return work_done;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ * ixgbe_low_latency_recv - busy poll the Rx rings of a q_vector
+ * @napi: napi struct of the q_vector a socket is waiting on
+ *
+ * Called by a busy polling socket with bottom halves disabled, cleans a
+ * few packets without waiting for the interrupt.
+ **/
+static int ixgbe_low_latency_recv(struct napi_struct *napi)
+{
+	struct ixgbe_q_vector *q_vector =
+	                       container_of(napi, struct ixgbe_q_vector, napi);
+	struct ixgbe_adapter *adapter = q_vector->adapter;
+	int found = 0, i;
+	long r_idx;
+
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!ixgbe_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	if (!(adapter->flags & IXGBE_FLAG_MSIX_ENABLED)) {
+		ixgbe_clean_rx_irq(q_vector, adapter->rx_ring, &found, 4);
+	} else {
+		r_idx = find_first_bit(q_vector->rxr_idx,
+		                       adapter->num_rx_queues);
+		for (i = 0; i < q_vector->rxr_count && !found; i++) {
+			ixgbe_clean_rx_irq(q_vector, &(adapter->rx_ring[r_idx]),
+			                   &found, 4);
+			r_idx = find_next_bit(q_vector->rxr_idx,
+			                      adapter->num_rx_queues, r_idx + 1);
+		}
+	}
+
+	ixgbe_qv_unlock_poll(q_vector);
+
+	return found;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ixgbe_tx_timeout - Respond to a Tx Hang
  * @netdev: network interface device structure
@@ -3751,6 +3828,7 @@ static int ixgbe_alloc_q_vectors(struct ixgbe_adapter *adapter)
 			q_vector->eitr = adapter->rx_eitr_param;
 		q_vector->v_idx = q_idx;
 		netif_napi_add(adapter->netdev, &q_vector->napi, (*poll), 64);
+		napi_hash_add(&q_vector->napi);
 		adapter->q_vector[q_idx] = q_vector;
 	}
 
@@ -3760,6 +3838,7 @@ err_out:
 	while (q_idx) {
 		q_idx--;
 		q_vector = adapter->q_vector[q_idx];
+		napi_hash_del(&q_vector->napi);
 		netif_napi_del(&q_vector->napi);
 		kfree(q_vector);
 		adapter->q_vector[q_idx] = NULL;
@@ -3784,6 +3863,12 @@ static void ixgbe_free_q_vectors(struct ixgbe_adapter *adapter)
 	else
 		num_q_vectors = 1;
 
+	for (q_idx = 0; q_idx < num_q_vectors; q_idx++)
+		napi_hash_del(&adapter->q_vector[q_idx]->napi);
+
+	/* wait for busy polling sockets still looking at the q_vectors */
+	synchronize_net();
+
 	for (q_idx = 0; q_idx < num_q_vectors; q_idx++) {
 		struct ixgbe_q_vector *q_vector = adapter->q_vector[q_idx];
 		adapter->q_vector[q_idx] = NULL;
@@ -5452,6 +5537,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		txq = netdev_get_tx_queue(netdev, tx_ring->queue_index);
 		txq->tx_bytes += skb->len;
 		txq->tx_packets++;
+		netdev_tx_sent_queue(txq, skb->len);
 		ixgbe_tx_queue(adapter, tx_ring, tx_flags, count, skb->len,
 		               hdr_len);
 		ixgbe_maybe_stop_tx(netdev, tx_ring, DESC_NEEDED);
@@ -5612,6 +5698,9 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= ixgbe_netpoll,
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll		= ixgbe_low_latency_recv,
+#endif
 #ifdef IXGBE_FCOE
 	.ndo_fcoe_ddp_setup = ixgbe_fcoe_ddp_get,
 	.ndo_fcoe_ddp_done = ixgbe_fcoe_ddp_put,
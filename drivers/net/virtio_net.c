@@ -116,6 +116,10 @@ static void skb_xmit_done(struct virtqueue *svq)
 
 	/* We were probably waiting for more output buffers. */
 	netif_wake_queue(vi->dev);
+
+	/* Or for completions to restart a queue stopped by byte queue
+	 * limits, which only get reaped with the tx lock held. */
+	napi_schedule(&vi->napi);
 }
 
 static void receive_skb(struct net_device *dev, struct sk_buff *skb,
@@ -404,6 +408,8 @@ static void refill_work(struct work_struct *work)
 		schedule_delayed_work(&vi->refill, HZ/2);
 }
 
+static bool virtnet_reap_tx(struct virtnet_info *vi);
+
 static int virtnet_poll(struct napi_struct *napi, int budget)
 {
 	struct virtnet_info *vi = container_of(napi, struct virtnet_info, napi);
@@ -424,6 +430,10 @@ again:
 			schedule_delayed_work(&vi->refill, 0);
 	}
 
+	/* Poll again if somebody else held the tx lock */
+	if (unlikely(!virtnet_reap_tx(vi)))
+		return budget;
+
 	/* Out of packets? */
 	if (received < budget) {
 		napi_complete(napi);
@@ -442,18 +452,57 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int bytes = 0, pkts = 0;
 
 	while ((skb = vi->svq->vq_ops->get_buf(vi->svq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
 		__skb_unlink(skb, &vi->send);
 		vi->dev->stats.tx_bytes += skb->len;
 		vi->dev->stats.tx_packets++;
+		bytes += skb->len;
+		pkts++;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+	netdev_completed_queue(vi->dev, pkts, bytes);
 	return tot_sgs;
 }
 
+/* Stopped by byte queue limits rather than for lack of ring space? */
+static inline bool virtnet_bql_stopped(struct netdev_queue *txq)
+{
+	return netif_xmit_stopped(txq) && !netif_tx_queue_stopped(txq);
+}
+
+/*
+ * start_xmit() is not called for a queue stopped by byte queue limits, so
+ * keep the tx interrupt armed until the completions that restart it have
+ * been reaped.  Called with the tx lock held.
+ */
+static void virtnet_arm_tx(struct virtnet_info *vi, struct netdev_queue *txq)
+{
+	while (virtnet_bql_stopped(txq) &&
+	       !vi->svq->vq_ops->enable_cb(vi->svq))
+		free_old_xmit_skbs(vi);
+}
+
+/* Returns false if the tx lock was busy and this should be retried. */
+static bool virtnet_reap_tx(struct virtnet_info *vi)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	if (likely(!virtnet_bql_stopped(txq)))
+		return true;
+	if (!__netif_tx_trylock(txq))
+		return false;
+
+	free_old_xmit_skbs(vi);
+	virtnet_arm_tx(vi, txq);
+
+	__netif_tx_unlock(txq);
+	return true;
+}
+
 static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 {
 	struct scatterlist sg[2+MAX_SKB_FRAGS];
@@ -527,6 +576,7 @@ again:
 		return NETDEV_TX_BUSY;
 	}
 	vi->svq->vq_ops->kick(vi->svq);
+	netdev_sent_queue(dev, skb->len);
 
 	/*
 	 * Put new one in send queue.  You'd expect we'd need this before
@@ -555,6 +605,8 @@ again:
 		}
 	}
 
+	virtnet_arm_tx(vi, netdev_get_tx_queue(dev, 0));
+
 	return NETDEV_TX_OK;
 }
 
@@ -204,6 +204,45 @@ static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 	return 0;
 }
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return 0;
+}
+static inline int pmd_write(pmd_t pmd)
+{
+	BUG();
+	return 0;
+}
+#define pmdp_clear_flush_young(__vma, __address, __pmdp)		\
+({									\
+	BUG();								\
+	0;								\
+})
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+/*
+ * Page table walkers that can run with only mmap_sem held for reading
+ * may find a transparent huge pmd established from under them by a
+ * concurrent page fault even after splitting it.  Such a pmd is not a
+ * pte table and must be skipped rather than cleared as bad.
+ */
+static inline int pmd_none_or_trans_huge_or_clear_bad(pmd_t *pmd)
+{
+	pmd_t pmdval = *pmd;
+
+	barrier();
+	if (pmd_none(pmdval))
+		return 1;
+	if (pmd_trans_huge(pmdval))
+		return 1;
+	if (unlikely(pmd_bad(pmdval))) {
+		pmd_clear_bad(pmd);
+		return 1;
+	}
+	return 0;
+}
+
 static inline pte_t __ptep_modify_prot_start(struct mm_struct *mm,
 					     unsigned long addr,
 					     pte_t *ptep)
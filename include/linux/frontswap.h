@@ -0,0 +1,146 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+#include <linux/vmalloc.h>
+
+/*
+ * Frontswap lets a backend intercept swap pages on their way to and
+ * from the swap device: a page that the backend accepts in ->store()
+ * is never written to disk, and ->load() is asked for it before a read
+ * is issued.  The backend may refuse any page, in which case the swap
+ * device is used as usual.  All calls for a given swap type and offset
+ * are made with the swap cache page locked.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*store)(unsigned type, pgoff_t offset, struct page *page);
+	int (*load)(unsigned type, pgoff_t offset, struct page *page);
+	void (*invalidate_page)(unsigned type, pgoff_t offset);
+	void (*invalidate_area)(unsigned type);
+};
+
+#ifdef CONFIG_FRONTSWAP
+extern bool frontswap_enabled;
+extern struct frontswap_ops
+	frontswap_register_ops(struct frontswap_ops *ops);
+
+extern void __frontswap_init(struct swap_info_struct *sis);
+extern int __frontswap_store(struct page *page);
+extern int __frontswap_load(struct page *page);
+extern void __frontswap_invalidate_page(struct swap_info_struct *sis,
+					pgoff_t offset);
+extern void __frontswap_invalidate_area(struct swap_info_struct *sis);
+extern void frontswap_writeback_done(struct page *page);
+
+static inline bool frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (frontswap_enabled && sis->frontswap_map)
+		return test_bit(offset, sis->frontswap_map);
+	return false;
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return sis->frontswap_map;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+	sis->frontswap_map = map;
+	atomic_set(&sis->frontswap_pages, 0);
+}
+
+static inline unsigned long *frontswap_map_alloc(unsigned long maxpages)
+{
+	unsigned long size = BITS_TO_LONGS(maxpages) * sizeof(long);
+	unsigned long *map = vmalloc(size);
+
+	if (map)
+		memset(map, 0, size);
+	return map;
+}
+
+static inline int frontswap_store(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_store(page);
+	return -1;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_load(page);
+	return -1;
+}
+
+static inline void frontswap_init(struct swap_info_struct *sis)
+{
+	if (frontswap_enabled)
+		__frontswap_init(sis);
+}
+
+static inline void frontswap_invalidate_page(struct swap_info_struct *sis,
+					     pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_page(sis, offset);
+}
+
+static inline void frontswap_invalidate_area(struct swap_info_struct *sis)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_area(sis);
+}
+#else /* CONFIG_FRONTSWAP */
+#define frontswap_enabled (0)
+
+static inline bool frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return false;
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return NULL;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+}
+
+static inline unsigned long *frontswap_map_alloc(unsigned long maxpages)
+{
+	return NULL;
+}
+
+static inline int frontswap_store(struct page *page)
+{
+	return -1;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	return -1;
+}
+
+static inline void frontswap_init(struct swap_info_struct *sis)
+{
+}
+
+static inline void frontswap_invalidate_page(struct swap_info_struct *sis,
+					     pgoff_t offset)
+{
+}
+
+static inline void frontswap_invalidate_area(struct swap_info_struct *sis)
+{
+}
+#endif /* CONFIG_FRONTSWAP */
+
+#endif /* _LINUX_FRONTSWAP_H */
@@ -0,0 +1,379 @@
+#ifndef _IP_SET_AHASH_H
+#define _IP_SET_AHASH_H
+
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+/* Hashing which uses arrays to resolve clashing. The hash table is resized
+ * (doubled) when searching becomes too long.
+ *
+ * Elements are of fixed size, compared with memcmp() and hashed with
+ * jhash2(): the size must be a multiple of four bytes and the padding
+ * must be zeroed. All functions are called with set->lock held, except
+ * ahash_resize() which takes it itself.
+ */
+
+/* Number of elements to store in an initial array block */
+#define AHASH_INIT_SIZE			4
+/* Max number of elements to store in an array block */
+#define AHASH_MAX_SIZE			(3*AHASH_INIT_SIZE)
+
+/* A hash bucket */
+struct hbucket {
+	void *value;		/* the array of the values */
+	u8 size;		/* size of the array */
+	u8 pos;			/* position of the first free entry */
+};
+
+/* The hash table: the table size stored here in order to make resizing easy */
+struct htable {
+	u8 htable_bits;		/* size of hash table == 2^htable_bits */
+	struct hbucket bucket[0]; /* hashtable buckets */
+};
+
+#define hbucket(h, i)		(&((h)->bucket[i]))
+
+/* The generic hash structure, embedded into the set type data */
+struct ip_set_hash {
+	struct htable *table;	/* the hash table */
+	u32 maxelem;		/* max elements in the hash */
+	u32 elements;		/* current element count */
+	u32 initval;		/* random jhash init value */
+	u8 dsize;		/* size of an element in bytes */
+};
+
+#define jhash_size(n)		((u32)1<<(n))
+#define jhash_mask(n)		(jhash_size(n)-1)
+
+/* Compute htable_bits from the user input parameter hashsize */
+static u8
+htable_bits(u32 hashsize)
+{
+	/* Assume that hashsize == 2^htable_bits */
+	u8 bits = fls(hashsize - 1);
+
+	if (jhash_size(bits) != hashsize)
+		/* Round up to the first 2^n value */
+		bits = fls(hashsize);
+
+	return bits;
+}
+
+static inline u32
+ahash_bucket(const struct ip_set_hash *h, const struct htable *t,
+	     const void *d)
+{
+	return jhash2(d, h->dsize / sizeof(u32), h->initval)
+		& jhash_mask(t->htable_bits);
+}
+
+static inline void *
+ahash_data(const struct ip_set_hash *h, const struct hbucket *n, int i)
+{
+	return (char *)n->value + i * h->dsize;
+}
+
+static struct htable *
+ahash_alloc_table(u8 bits)
+{
+	struct htable *t;
+
+	if (bits > 31 ||
+	    jhash_size(bits) > (ULONG_MAX - sizeof(*t)) / sizeof(struct hbucket))
+		return NULL;
+	t = ip_set_alloc(sizeof(*t) + jhash_size(bits) * sizeof(struct hbucket));
+	if (t)
+		t->htable_bits = bits;
+	return t;
+}
+
+/* Destroy the hashtable part of the set */
+static void
+ahash_destroy_table(struct htable *t)
+{
+	struct hbucket *n;
+	u32 i;
+
+	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+		n = hbucket(t, i);
+		if (n->size)
+			kfree(n->value);
+	}
+
+	ip_set_free(t);
+}
+
+/* Calculate the actual memory size of the set data */
+static size_t
+ahash_memsize(const struct ip_set_hash *h, size_t hsize)
+{
+	const struct htable *t = h->table;
+	size_t memsize = hsize + sizeof(*t)
+		+ jhash_size(t->htable_bits) * sizeof(struct hbucket);
+	u32 i;
+
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		memsize += t->bucket[i].size * h->dsize;
+
+	return memsize;
+}
+
+static int
+ahash_init(struct ip_set_hash *h, u32 hashsize, u32 maxelem, u8 dsize)
+{
+	if (hashsize < IPSET_MINIMAL_HASHSIZE)
+		hashsize = IPSET_MINIMAL_HASHSIZE;
+
+	h->table = ahash_alloc_table(htable_bits(hashsize));
+	if (!h->table)
+		return -ENOMEM;
+
+	h->maxelem = maxelem;
+	h->elements = 0;
+	h->dsize = dsize;
+	get_random_bytes(&h->initval, sizeof(h->initval));
+
+	return 0;
+}
+
+/* Remove all elements from the set */
+static void
+ahash_flush(struct ip_set_hash *h)
+{
+	struct htable *t = h->table;
+	struct hbucket *n;
+	u32 i;
+
+	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+		n = hbucket(t, i);
+		if (n->size) {
+			n->size = n->pos = 0;
+			kfree(n->value);
+			n->value = NULL;
+		}
+	}
+	h->elements = 0;
+}
+
+/* Add an element to a bucket, growing the bucket array when needed */
+static int
+ahash_add_elem(const struct ip_set_hash *h, struct hbucket *n, const void *d)
+{
+	if (n->pos >= n->size) {
+		void *tmp;
+
+		if (n->size >= AHASH_MAX_SIZE)
+			/* Trigger rehashing */
+			return -EAGAIN;
+
+		tmp = kzalloc((n->size + AHASH_INIT_SIZE) * h->dsize,
+			      GFP_ATOMIC);
+		if (!tmp)
+			return -ENOMEM;
+		if (n->size) {
+			memcpy(tmp, n->value, n->size * h->dsize);
+			kfree(n->value);
+		}
+		n->value = tmp;
+		n->size += AHASH_INIT_SIZE;
+	}
+	memcpy(ahash_data(h, n, n->pos++), d, h->dsize);
+	return 0;
+}
+
+/* Test whether the element is in the set */
+static bool
+ahash_test(const struct ip_set_hash *h, const void *d)
+{
+	const struct htable *t = h->table;
+	const struct hbucket *n = hbucket(t, ahash_bucket(h, t, d));
+	int i;
+
+	for (i = 0; i < n->pos; i++)
+		if (memcmp(ahash_data(h, n, i), d, h->dsize) == 0)
+			return true;
+	return false;
+}
+
+/* Add an element to the set. Returns -EAGAIN when the bucket is full
+ * and the table must be resized. */
+static int
+ahash_add(struct ip_set_hash *h, const void *d)
+{
+	struct htable *t = h->table;
+	struct hbucket *n;
+	int i, ret;
+
+	if (h->elements >= h->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+
+	n = hbucket(t, ahash_bucket(h, t, d));
+	for (i = 0; i < n->pos; i++)
+		if (memcmp(ahash_data(h, n, i), d, h->dsize) == 0)
+			return -IPSET_ERR_EXIST;
+
+	ret = ahash_add_elem(h, n, d);
+	if (ret != 0)
+		return ret;
+
+	h->elements++;
+	return 0;
+}
+
+/* Delete an element from the set: the last one of the bucket is
+ * moved into its place and the array is shrunk when it got sparse. */
+static int
+ahash_del(struct ip_set_hash *h, const void *d)
+{
+	struct htable *t = h->table;
+	struct hbucket *n;
+	int i;
+
+	n = hbucket(t, ahash_bucket(h, t, d));
+	for (i = 0; i < n->pos; i++) {
+		if (memcmp(ahash_data(h, n, i), d, h->dsize) != 0)
+			continue;
+		if (i != n->pos - 1)
+			/* Not last one */
+			memcpy(ahash_data(h, n, i),
+			       ahash_data(h, n, n->pos - 1), h->dsize);
+
+		n->pos--;
+		h->elements--;
+		if (n->pos + AHASH_INIT_SIZE < n->size) {
+			void *tmp = kzalloc((n->size - AHASH_INIT_SIZE)
+					    * h->dsize, GFP_ATOMIC);
+			if (!tmp)
+				return 0;
+			n->size -= AHASH_INIT_SIZE;
+			memcpy(tmp, n->value, n->size * h->dsize);
+			kfree(n->value);
+			n->value = tmp;
+		}
+		return 0;
+	}
+
+	return -IPSET_ERR_EXIST;
+}
+
+/* Resize a hash: create a new hash table with doubling the hashsize
+ * and inserting the elements to it. Repeat until we succeed or
+ * fail due to memory pressures.
+ *
+ * The new table is allocated without holding the set lock, the
+ * elements are moved over with the lock held for writing so that
+ * neither the packet path nor userspace can see a half built table.
+ */
+static int
+ahash_resize(struct ip_set *set, struct ip_set_hash *h)
+{
+	struct htable *t, *orig;
+	u8 bits;
+	void *data;
+	struct hbucket *n, *m;
+	u32 i, j;
+	int ret;
+
+	read_lock_bh(&set->lock);
+	bits = h->table->htable_bits;
+	read_unlock_bh(&set->lock);
+retry:
+	ret = 0;
+	bits++;
+	if (bits > 31)
+		/* In case we have plenty of memory :-) */
+		return -IPSET_ERR_HASH_FULL;
+	t = ahash_alloc_table(bits);
+	if (!t)
+		return -ENOMEM;
+
+	write_lock_bh(&set->lock);
+	orig = h->table;
+	for (i = 0; i < jhash_size(orig->htable_bits); i++) {
+		n = hbucket(orig, i);
+		for (j = 0; j < n->pos; j++) {
+			data = ahash_data(h, n, j);
+			m = hbucket(t, ahash_bucket(h, t, data));
+			ret = ahash_add_elem(h, m, data);
+			if (ret < 0) {
+				write_unlock_bh(&set->lock);
+				ahash_destroy_table(t);
+				if (ret == -EAGAIN)
+					goto retry;
+				return ret;
+			}
+		}
+	}
+
+	h->table = t;
+	write_unlock_bh(&set->lock);
+
+	ahash_destroy_table(orig);
+
+	return 0;
+}
+
+/* Put the generic hash parameters into the set header */
+static int
+ahash_head(const struct ip_set_hash *h, struct sk_buff *skb, size_t hsize,
+	   u32 ref)
+{
+	NLA_PUT_NET32(skb, IPSET_ATTR_HASHSIZE,
+		      htonl(jhash_size(h->table->htable_bits)));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem));
+	NLA_PUT_NET32(skb, IPSET_ATTR_REFERENCES, htonl(ref));
+	NLA_PUT_NET32(skb, IPSET_ATTR_MEMSIZE,
+		      htonl(ahash_memsize(h, hsize)));
+	NLA_PUT_NET32(skb, IPSET_ATTR_ELEMENTS, htonl(h->elements));
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+/* Reply a LIST/SAVE request: dump the elements, resuming at the
+ * bucket stored in cb->args[3]. Returns -EMSGSIZE when the skb got
+ * full and the dump must be continued. */
+static int
+ahash_list(const struct ip_set_hash *h, struct sk_buff *skb,
+	   struct netlink_callback *cb,
+	   int (*data_list)(struct sk_buff *skb, const void *data))
+{
+	const struct htable *t = h->table;
+	struct nlattr *atd, *nested;
+	const struct hbucket *n;
+	void *incomplete;
+	int i;
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+	for (; cb->args[3] < jhash_size(t->htable_bits); cb->args[3]++) {
+		incomplete = skb_tail_pointer(skb);
+		n = hbucket(t, cb->args[3]);
+		for (i = 0; i < n->pos; i++) {
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested)
+				goto nla_put_failure;
+			if (data_list(skb, ahash_data(h, n, i)))
+				goto nla_put_failure;
+			ipset_nest_end(skb, nested);
+		}
+	}
+	ipset_nest_end(skb, atd);
+	/* Set listing finished */
+	cb->args[3] = 0;
+
+	return 0;
+
+nla_put_failure:
+	/* Buckets are never split between messages */
+	nlmsg_trim(skb, incomplete);
+	ipset_nest_end(skb, atd);
+	return -EMSGSIZE;
+}
+
+#endif /* _IP_SET_AHASH_H */
@@ -0,0 +1,28 @@
+#ifndef _XT_SET_H
+#define _XT_SET_H
+
+#include <linux/types.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+/* Only one-dimensional sets are supported by revision 0 */
+
+struct xt_set_info {
+	char name[IPSET_MAXNAMELEN];
+	__u8 dim;
+	__u8 flags;
+
+	/* Used internally by the kernel */
+	ip_set_id_t index;
+};
+
+/* match and target infos */
+struct xt_set_info_match {
+	struct xt_set_info match_set;
+};
+
+struct xt_set_info_target {
+	struct xt_set_info add_set;
+	struct xt_set_info del_set;
+};
+
+#endif /*_XT_SET_H*/
@@ -23,6 +23,13 @@
 
 #define DEFAULT_POLLMASK (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM)
 
+/*
+ * Kernel internal event bit: set in the poll_table key by select/poll
+ * when they want ->poll() to busy loop, and returned by sock_poll()
+ * to tell them the file supports busy polling at all.
+ */
+#define POLL_BUSY_LOOP	0x8000
+
 struct poll_table_struct;
 
 /* 
@@ -169,6 +169,8 @@ struct skb_shared_hwtstamps {
  * @software:		generate software time stamp
  * @in_progress:	device driver is going to provide
  *			hardware time stamp
+ * @zerocopy:		frags reference user pages, destructor_arg
+ *			points to the &ubuf_info tracking them
  * @flags:		all shared_tx flags
  *
  * These flags are attached to packets as part of the
@@ -178,11 +180,34 @@ union skb_shared_tx {
 	struct {
 		__u8	hardware:1,
 			software:1,
-			in_progress:1;
+			in_progress:1,
+			zerocopy:1;
 	};
 	__u8 flags;
 };
 
+/**
+ * struct ubuf_info - zerocopy transmit completion state
+ * @callback:	called once the last skb referencing the user pages is
+ *		freed; @zerocopy_success is false if the data had to be
+ *		copied after all
+ * @id:		first send call covered, in the socket's sk_zckey sequence
+ * @len:	number of send calls covered
+ * @zerocopy:	cleared as soon as any part of the data was copied
+ * @refcnt:	one reference per &skb_shared_info holding the user pages,
+ *		plus one held by the sending call
+ *
+ * Lives in the cb[] of the skb that is queued on the socket error queue
+ * as the completion notification.
+ */
+struct ubuf_info {
+	void (*callback)(struct ubuf_info *, bool zerocopy_success);
+	u32 id;
+	u16 len;
+	u16 zerocopy:1;
+	atomic_t refcnt;
+};
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -243,6 +268,14 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* This indicates the segments are carried inside a GRE tunnel. */
+	SKB_GSO_GRE = 1 << 6,
+
+	/* This indicates a UDP datagram to be split into gso_size sized
+	 * datagrams, as opposed to SKB_GSO_UDP which fragments at IP level.
+	 */
+	SKB_GSO_UDP_L4 = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -300,6 +333,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@nfct_reasm: netfilter conntrack re-assembly pointer
  *	@nf_bridge: Saved data about a bridged frame - see br_netfilter.c
  *	@skb_iif: ifindex of device we arrived on
+ *	@rxhash: the packet hash computed on receive
  *	@queue_mapping: Queue mapping for multiqueue devices
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
@@ -307,6 +341,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@vlan_tci: vlan tag control information
  */
 
@@ -354,8 +389,8 @@ struct sk_buff {
 				ipvs_property:1,
 				peeked:1,
 				nf_trace:1;
-	__be16			protocol:16;
 	kmemcheck_bitfield_end(flags1);
+	__be16			protocol;
 
 	void			(*destructor)(struct sk_buff *skb);
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
@@ -367,6 +402,7 @@ struct sk_buff {
 #endif
 
 	int			skb_iif;
+	__u32			rxhash;
 #ifdef CONFIG_NET_SCHED
 	__u16			tc_index;	/* traffic control index */
 #ifdef CONFIG_NET_CLS_ACT
@@ -374,8 +410,8 @@ struct sk_buff {
 #endif
 #endif
 
+	__u16			queue_mapping;
 	kmemcheck_bitfield_begin(flags2);
-	__u16			queue_mapping:16;
 #ifdef CONFIG_IPV6_NDISC_NODETYPE
 	__u8			ndisc_nodetype:2;
 #endif
@@ -388,6 +424,9 @@ struct sk_buff {
 #endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
 #endif
 	union {
 		__u32		mark;
@@ -529,6 +568,73 @@ static inline union skb_shared_tx *skb_tx(struct sk_buff *skb)
 	return &skb_shinfo(skb)->tx_flags;
 }
 
+extern struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+extern int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+				    const void __user *from, int len,
+				    struct ubuf_info *uarg);
+extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
+
+static inline void sock_zerocopy_get(struct ubuf_info *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+#define skb_uarg(SKB)	((struct ubuf_info *)(skb_shinfo(SKB)->destructor_arg))
+
+static inline struct ubuf_info *skb_zcopy(struct sk_buff *skb)
+{
+	bool is_zcopy = skb && skb_tx(skb)->zerocopy;
+
+	return is_zcopy ? skb_uarg(skb) : NULL;
+}
+
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	if (skb && uarg && !skb_zcopy(skb)) {
+		sock_zerocopy_get(uarg);
+		skb_shinfo(skb)->destructor_arg = uarg;
+		skb_tx(skb)->zerocopy = 1;
+	}
+}
+
+/* Release a reference on a zerocopy structure */
+static inline void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
+{
+	struct ubuf_info *uarg = skb_zcopy(skb);
+
+	if (uarg) {
+		uarg->zerocopy = uarg->zerocopy && zerocopy;
+		skb_tx(skb)->zerocopy = 0;
+		sock_zerocopy_put(uarg);
+	}
+}
+
+/* @nskb got a share of the frags of @orig: make it pin the same
+ * completion. @nskb must not track user pages of its own.
+ */
+static inline void skb_zerocopy_clone(struct sk_buff *nskb,
+				      struct sk_buff *orig)
+{
+	skb_zcopy_set(nskb, skb_zcopy(orig));
+}
+
+/**
+ *	skb_orphan_frags - make a local copy of zerocopy user pages
+ *	@skb: buffer to orphan frags from
+ *	@gfp_mask: allocation mask for replacement pages
+ *
+ *	Used before an skb that may reference user pages is held for an
+ *	unbounded time, e.g. when it is queued on a local receiving socket.
+ */
+static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_zcopy(skb)))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -103,6 +103,7 @@ enum {
 #define TCP_CONGESTION		13	/* Congestion control algorithm */
 #define TCP_MD5SIG		14	/* TCP MD5 Signature (RFC2385) */
 #define TCP_COOKIE_TRANSACTIONS	15	/* TCP Cookie Transactions */
+#define TCP_FASTOPEN		23	/* Enable Fast Open on listeners */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
@@ -269,6 +270,7 @@ static inline void tcp_clear_options(struct tcp_options_received *rx_opt)
 #define TCP_NUM_SACKS 4
 
 struct tcp_cookie_values;
+struct tcp_fastopen_request;
 struct tcp_request_sock_ops;
 
 struct tcp_request_sock {
@@ -279,6 +281,8 @@ struct tcp_request_sock {
 #endif
 	u32				rcv_isn;
 	u32				snt_isn;
+	u32				rcv_nxt; /* the ack # by SYN-ACK */
+	struct sock			*listener; /* Fast Open listener */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -313,6 +317,9 @@ struct tcp_sock {
 	u32	rcv_tstamp;	/* timestamp of last received ACK (for keepalives) */
 	u32	lsndtime;	/* timestamp of last sent data packet (for restart window) */
 
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+	unsigned long	tsq_flags;
+
 	/* Data for direct copy to user */
 	struct {
 		struct sk_buff_head	prequeue;
@@ -358,6 +365,9 @@ struct tcp_sock {
 	u32	snd_up;		/* Urgent pointer		*/
 
 	u8	keepalive_probes; /* num of allowed keep alive probes	*/
+	u8	syn_fastopen:1,	/* SYN includes Fast Open option */
+		syn_data:1,	/* SYN includes data */
+		syn_data_acked:1; /* data in SYN is acked by SYN-ACK */
 /*
  *      Options received (usually on last packet, some only on SYN packets).
  */
@@ -454,6 +464,19 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+	/* Fast Open: data to carry in the SYN on the active side; on the
+	 * passive side, the request whose SYN-ACK this child still has to
+	 * retransmit until the handshake completes.
+	 */
+	struct tcp_fastopen_request *fastopen_req;
+	struct request_sock	*fastopen_rsk;
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,
+	TSQ_QUEUED,
+	TCP_TSQ_DEFERRED,	   /* tcp_tasklet_func() found socket was owned */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
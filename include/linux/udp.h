@@ -29,6 +29,7 @@ struct udphdr {
 /* UDP socket options */
 #define UDP_CORK	1	/* Never send partially complete segments */
 #define UDP_ENCAP	100	/* Set the socket to accept encapsulated packets */
+#define UDP_SEGMENT	103	/* Set GSO segmentation size */
 
 /* UDP encapsulation types */
 #define UDP_ENCAP_ESPINUDP_NON_IKE	1 /* draft-ietf-ipsec-nat-t-ike-00/01 */
@@ -47,6 +48,9 @@ static inline struct udphdr *udp_hdr(const struct sk_buff *skb)
 
 #define UDP_HTABLE_SIZE_MIN		(CONFIG_BASE_SMALL ? 128 : 256)
 
+/* Upper bound on the datagrams a single UDP_SEGMENT send may produce */
+#define UDP_MAX_SEGMENTS		(1 << 6UL)
+
 static inline int udp_hashfn(struct net *net, unsigned num, unsigned mask)
 {
 	return (num + net_hash_mix(net)) & mask;
@@ -77,6 +81,10 @@ struct udp_sock {
 #define UDPLITE_RECV_CC  0x4		/* set via udplite setsocktopt        */
 	__u8		 pcflag;        /* marks socket as UDP-Lite if > 0    */
 	__u8		 unused[3];
+	/*
+	 * Segment size for UDP_SEGMENT, 0 if disabled.
+	 */
+	__u16		 gso_size;
 	/*
 	 * For encapsulation sockets.
 	 */
@@ -47,6 +47,7 @@ struct dst_entry {
 #define DST_NOXFRM		2
 #define DST_NOPOLICY		4
 #define DST_NOHASH		8
+#define DST_NOCACHE		16
 	unsigned long		expires;
 
 	unsigned short		header_len;	/* more space at head required */
@@ -202,6 +203,8 @@ extern int dst_discard(struct sk_buff *skb);
 extern void * dst_alloc(struct dst_ops * ops);
 extern void __dst_free(struct dst_entry * dst);
 extern struct dst_entry *dst_destroy(struct dst_entry * dst);
+extern void dst_ifdown(struct dst_entry *dst, struct net_device *dev,
+		       int unregister);
 
 static inline void dst_free(struct dst_entry * dst)
 {
@@ -26,7 +26,6 @@ extern int inet6_csk_bind_conflict(const struct sock *sk,
 				   const struct inet_bind_bucket *tb);
 
 extern struct request_sock *inet6_csk_search_req(const struct sock *sk,
-						 struct request_sock ***prevp,
 						 const __be16 rport,
 						 const struct in6_addr *raddr,
 						 const struct in6_addr *laddr,
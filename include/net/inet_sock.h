@@ -141,6 +141,7 @@ struct inet_sock {
 	struct {
 		unsigned int		flags;
 		unsigned int		fragsize;
+		unsigned int		gso_size;
 		struct ip_options	*opt;
 		struct dst_entry	*dst;
 		int			length; /* Total length of all frames */
@@ -26,6 +26,13 @@ struct inet_peer {
 	atomic_t		ip_id_count;	/* IP ID for the next packet */
 	__u32			tcp_ts;
 	__u32			tcp_ts_stamp;
+	/* TCP Fast Open MSS and cookie (TCP_FASTOPEN_COOKIE_MAX bytes) */
+	__u16			tcp_fastopen_mss;
+	__s8			tcp_fastopen_cookie_len;
+	__u8			tcp_fastopen_cookie[16];
+	/* ICMP rate limiting, see inet_peer_xrlim_allow() and route.c */
+	unsigned long		rate_tokens;
+	unsigned long		rate_last;
 };
 
 void			inet_initpeers(void) __init;
@@ -36,6 +43,8 @@ struct inet_peer	*inet_getpeer(__be32 daddr, int create);
 /* can be called from BH context or outside */
 extern void inet_putpeer(struct inet_peer *p);
 
+extern bool inet_peer_xrlim_allow(struct inet_peer *peer, int timeout);
+
 /* can be called with or without local BH being disabled */
 static inline __u16	inet_getid(struct inet_peer *p, int more)
 {
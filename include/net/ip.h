@@ -54,6 +54,7 @@ struct ipcm_cookie {
 	int			oif;
 	struct ip_options	*opt;
 	union skb_shared_tx	shtx;
+	u16			gso_size;
 };
 
 #define IPCB(skb) ((struct inet_skb_parm*)((skb)->cb))
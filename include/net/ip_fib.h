@@ -44,6 +44,31 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
+
+/*
+ * Learned state for one destination reached through a nexthop:
+ * a PMTU (valid until fnhe_expires) and/or a redirected gateway.
+ */
+struct fib_nh_exception {
+	struct fib_nh_exception	*fnhe_next;
+	__be32			fnhe_daddr;
+	u32			fnhe_pmtu;
+	bool			fnhe_mtu_locked;
+	__be32			fnhe_gw;
+	unsigned long		fnhe_expires;
+	unsigned long		fnhe_stamp;
+};
+
+struct fnhe_hash_bucket {
+	struct fib_nh_exception	*chain;
+};
+
+#define FNHE_HASH_SIZE		2048
+#define FNHE_RECLAIM_DEPTH	5
+
+/* Forwarding routes cached per nexthop, one slot per input device hash. */
+#define NH_RTH_INPUT_SLOTS	4
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -60,6 +85,8 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	__be32			nh_gw;
+	struct fnhe_hash_bucket	*nh_exceptions;
+	struct rtable		*nh_rth_input[NH_RTH_INPUT_SLOTS];
 };
 
 /*
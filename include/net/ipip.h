@@ -49,8 +49,13 @@ struct ip_tunnel_prl_entry {
 	int err;							\
 	int pkt_len = skb->len - skb_transport_offset(skb);		\
 									\
-	skb->ip_summed = CHECKSUM_NONE;					\
-	ip_select_ident(iph, &rt->u.dst, NULL);				\
+	if (skb_is_gso(skb))						\
+		ip_select_ident_more(iph, &rt->u.dst, NULL,		\
+				     skb_shinfo(skb)->gso_segs - 1);	\
+	else {								\
+		skb->ip_summed = CHECKSUM_NONE;				\
+		ip_select_ident(iph, &rt->u.dst, NULL);			\
+	}								\
 									\
 	err = ip_local_out(skb);					\
 	if (likely(net_xmit_eval(err) == 0)) {				\
@@ -73,6 +73,15 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
-extern spinlock_t nf_conntrack_lock ;
+/* Hash chains are protected by one of CONNTRACK_LOCKS bucket locks,
+ * always taken through nf_conntrack_lock() so that a table resize can
+ * exclude all of them.  Expectations and helper private data are
+ * protected by nf_conntrack_expect_lock. */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_lock(spinlock_t *lock);
+
+extern spinlock_t nf_conntrack_expect_lock;
 
 #endif /* _NF_CONNTRACK_CORE_H */
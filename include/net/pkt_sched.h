@@ -98,6 +98,22 @@ static inline void qdisc_run(struct Qdisc *q)
 		__qdisc_run(q);
 }
 
+/*
+ * Give up __QDISC_STATE_RUNNING. Senders to a TCQ_F_NOLOCK qdisc which
+ * found it running leave their packets to the owner, so catch the ones
+ * queued after its last dequeue. A requeued gso_skb means the device
+ * queue is stopped and will reschedule us once it wakes up.
+ */
+static inline void qdisc_run_end(struct Qdisc *q)
+{
+	clear_bit(__QDISC_STATE_RUNNING, &q->state);
+	if (q->flags & TCQ_F_NOLOCK) {
+		smp_mb__after_clear_bit();
+		if (qdisc_qlen(q) && !q->gso_skb)
+			__netif_schedule(q);
+	}
+}
+
 extern int tc_classify_compat(struct sk_buff *skb, struct tcf_proto *tp,
 			      struct tcf_result *res);
 extern int tc_classify(struct sk_buff *skb, struct tcf_proto *tp,
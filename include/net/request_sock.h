@@ -17,6 +17,8 @@
 
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <linux/types.h>
 #include <linux/bug.h>
 
@@ -48,6 +50,10 @@ struct request_sock_ops {
 };
 
 /* struct request_sock - mini sock to represent a connection request
+ *
+ * Requests in a listener's SYN table are looked up without the listener
+ * lock, so they are reference counted and freed only after an RCU grace
+ * period.  The SYN table holds one reference, so does the accept queue.
  */
 struct request_sock {
 	struct request_sock		*dl_next; /* Must be first member! */
@@ -63,14 +69,19 @@ struct request_sock {
 	struct sock			*sk;
 	u32				secid;
 	u32				peer_secid;
+	atomic_t			rsk_refcnt;
+	u32				rsk_hash;	/* SYN table bucket */
+	struct rcu_head			rsk_rcu;
 };
 
 static inline struct request_sock *reqsk_alloc(const struct request_sock_ops *ops)
 {
 	struct request_sock *req = kmem_cache_alloc(ops->slab, GFP_ATOMIC);
 
-	if (req != NULL)
+	if (req != NULL) {
 		req->rsk_ops = ops;
+		atomic_set(&req->rsk_refcnt, 1);
+	}
 
 	return req;
 }
@@ -86,11 +97,25 @@ static inline void reqsk_free(struct request_sock *req)
 	__reqsk_free(req);
 }
 
+extern void reqsk_free_rcu(struct rcu_head *head);
+
+/* Requests that were never visible in a SYN table can still be released
+ * with reqsk_free() directly.
+ */
+static inline void reqsk_put(struct request_sock *req)
+{
+	if (atomic_dec_and_test(&req->rsk_refcnt))
+		call_rcu(&req->rsk_rcu, reqsk_free_rcu);
+}
+
 extern int sysctl_max_syn_backlog;
 
 /** struct listen_sock - listen state
  *
  * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ *
+ * @qlen and @qlen_young only change under %syn_wait_lock; lockless
+ * readers use them as hints.
  */
 struct listen_sock {
 	u8			max_qlen_log;
@@ -108,24 +133,26 @@ struct listen_sock {
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
- * @syn_wait_lock - serializer
+ * @syn_wait_lock - serializer of the SYN table
  *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
+ * SYNs are processed without the listener lock, so %syn_wait_lock, not the
+ * socket lock, serializes every change to @listen_opt: inserting, unlinking
+ * and expiring requests and the queue length counters.  Lookups walk the
+ * chains under RCU and only restart if an unlink raced with them.  The
+ * proc and inet_diag dumpers walk them under RCU as well.
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * The accept queue itself is still protected by the listener lock.
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
 	struct request_sock	*rskq_accept_tail;
-	rwlock_t		syn_wait_lock;
+	seqlock_t		syn_wait_lock;
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
+	/* Fast Open children still in SYN_RECV, bounded by TCP_FASTOPEN */
+	atomic_t		fastopen_qlen;
+	int			fastopen_max_qlen;
 };
 
 extern int reqsk_queue_alloc(struct request_sock_queue *queue,
@@ -148,14 +175,8 @@ static inline int reqsk_queue_empty(struct request_sock_queue *queue)
 	return queue->rskq_accept_head == NULL;
 }
 
-static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
-				      struct request_sock *req,
-				      struct request_sock **prev_req)
-{
-	write_lock(&queue->syn_wait_lock);
-	*prev_req = req->dl_next;
-	write_unlock(&queue->syn_wait_lock);
-}
+extern bool reqsk_queue_unlink(struct request_sock_queue *queue,
+			       struct request_sock *req);
 
 static inline void reqsk_queue_add(struct request_sock_queue *queue,
 				   struct request_sock *req,
@@ -196,60 +217,44 @@ static inline struct sock *reqsk_queue_get_child(struct request_sock_queue *queu
 	WARN_ON(child == NULL);
 
 	sk_acceptq_removed(parent);
-	__reqsk_free(req);
+	reqsk_put(req);
 	return child;
 }
 
-static inline int reqsk_queue_removed(struct request_sock_queue *queue,
-				      struct request_sock *req)
+/* Called with syn_wait_lock held. */
+static inline void reqsk_queue_removed(struct listen_sock *lopt,
+				       struct request_sock *req)
 {
-	struct listen_sock *lopt = queue->listen_opt;
-
 	if (req->retrans == 0)
 		--lopt->qlen_young;
-
-	return --lopt->qlen;
-}
-
-static inline int reqsk_queue_added(struct request_sock_queue *queue)
-{
-	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
-
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	--lopt->qlen;
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	struct listen_sock *lopt = rcu_dereference(queue->listen_opt);
+
+	return lopt != NULL ? lopt->qlen : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
-}
+	struct listen_sock *lopt = rcu_dereference(queue->listen_opt);
 
-static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
-{
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	return lopt != NULL ? lopt->qlen_young : 0;
 }
 
-static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
-					u32 hash, struct request_sock *req,
-					unsigned long timeout)
+/* A listener that is going away accepts no more requests. */
+static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	struct listen_sock *lopt = queue->listen_opt;
+	struct listen_sock *lopt = rcu_dereference(queue->listen_opt);
 
-	req->expires = jiffies + timeout;
-	req->retrans = 0;
-	req->sk = NULL;
-	req->dl_next = lopt->syn_table[hash];
-
-	write_lock(&queue->syn_wait_lock);
-	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
+	return lopt != NULL ? lopt->qlen >> lopt->max_qlen_log : 1;
 }
 
+extern int reqsk_queue_hash_req(struct request_sock_queue *queue,
+				struct listen_sock *lopt, u32 hash,
+				struct request_sock *req,
+				unsigned long timeout);
+
 #endif /* _REQUEST_SOCK_H */
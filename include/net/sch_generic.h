@@ -44,6 +44,7 @@ struct Qdisc {
 #define TCQ_F_INGRESS		4
 #define TCQ_F_CAN_BYPASS	8
 #define TCQ_F_MQROOT		16
+#define TCQ_F_NOLOCK		32 /* enqueue/dequeue without qdisc_lock() */
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	struct Qdisc_ops	*ops;
@@ -73,6 +74,14 @@ struct Qdisc {
 	struct sk_buff_head	q;
 	struct gnet_stats_basic_packed bstats;
 	struct gnet_stats_queue	qstats;
+
+	/*
+	 * TCQ_F_NOLOCK qdiscs are enqueued to without any lock held, they
+	 * count here instead of in q.qlen, qstats.backlog and qstats.drops.
+	 */
+	atomic_t		nolock_qlen;
+	atomic_t		nolock_backlog;
+	atomic_t		nolock_drops;
 };
 
 struct Qdisc_class_ops {
@@ -178,11 +187,23 @@ struct qdisc_skb_cb {
 	char			data[];
 };
 
-static inline int qdisc_qlen(struct Qdisc *q)
+static inline int qdisc_qlen(const struct Qdisc *q)
 {
+	if (q->flags & TCQ_F_NOLOCK)
+		return atomic_read(&q->nolock_qlen);
 	return q->q.qlen;
 }
 
+/* Fold the counters of a lockless qdisc into the generic fields for dumping */
+static inline void qdisc_sync_nolock_stats(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK) {
+		q->q.qlen = atomic_read(&q->nolock_qlen);
+		q->qstats.backlog = atomic_read(&q->nolock_backlog);
+		q->qstats.drops = atomic_read(&q->nolock_drops);
+	}
+}
+
 static inline struct qdisc_skb_cb *qdisc_skb_cb(struct sk_buff *skb)
 {
 	return (struct qdisc_skb_cb *)skb->cb;
@@ -251,6 +272,7 @@ static inline void sch_tree_unlock(struct Qdisc *q)
 extern struct Qdisc noop_qdisc;
 extern struct Qdisc_ops noop_qdisc_ops;
 extern struct Qdisc_ops pfifo_fast_ops;
+extern struct Qdisc_ops pfifo_fast_nolock_ops;
 extern struct Qdisc_ops mq_qdisc_ops;
 
 struct Qdisc_class_common {
@@ -328,7 +350,7 @@ static inline bool qdisc_all_tx_empty(const struct net_device *dev)
 		struct netdev_queue *txq = netdev_get_tx_queue(dev, i);
 		const struct Qdisc *q = txq->qdisc;
 
-		if (q->q.qlen)
+		if (qdisc_qlen(q))
 			return false;
 	}
 	return true;
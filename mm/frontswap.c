@@ -0,0 +1,229 @@
+/*
+ * Frontswap frontend
+ *
+ * This code provides the generic "frontend" layer to call a matching
+ * "backend" driver implementation of frontswap.  The backend gets a
+ * chance to keep each swap page before it is written to the swap device,
+ * and to supply it again before it is read back.  See frontswap.h for
+ * the calling conventions.
+ */
+
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/frontswap.h>
+
+/*
+ * frontswap_ops is set by frontswap_register_ops to contain the pointers
+ * to the frontswap "backend" implementation functions.
+ */
+static struct frontswap_ops frontswap_ops __read_mostly;
+
+/*
+ * This global enablement flag reduces overhead on systems where frontswap
+ * is configured but no backend has registered.
+ */
+bool frontswap_enabled __read_mostly;
+EXPORT_SYMBOL(frontswap_enabled);
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Counters available via /sys/kernel/debug/frontswap.  They are updated
+ * without locking and are only meant as a rough guide.
+ */
+static u64 frontswap_loads;
+static u64 frontswap_succ_stores;
+static u64 frontswap_failed_stores;
+static u64 frontswap_invalidates;
+
+static inline void inc_frontswap_loads(void)
+{
+	frontswap_loads++;
+}
+static inline void inc_frontswap_succ_stores(void)
+{
+	frontswap_succ_stores++;
+}
+static inline void inc_frontswap_failed_stores(void)
+{
+	frontswap_failed_stores++;
+}
+static inline void inc_frontswap_invalidates(void)
+{
+	frontswap_invalidates++;
+}
+#else
+static inline void inc_frontswap_loads(void) { }
+static inline void inc_frontswap_succ_stores(void) { }
+static inline void inc_frontswap_failed_stores(void) { }
+static inline void inc_frontswap_invalidates(void) { }
+#endif
+
+/*
+ * Register operations for frontswap, returning the previous ones.  The
+ * backend should register before any swap area is enabled: areas that
+ * were already active are only used once swapped off and on again.
+ */
+struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops)
+{
+	struct frontswap_ops old = frontswap_ops;
+
+	frontswap_ops = *ops;
+	frontswap_enabled = true;
+	return old;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+/*
+ * Called when a swap area is being enabled.
+ */
+void __frontswap_init(struct swap_info_struct *sis)
+{
+	if (!sis->frontswap_map)
+		return;
+	if (frontswap_ops.init)
+		frontswap_ops.init(sis->type);
+}
+EXPORT_SYMBOL(__frontswap_init);
+
+/*
+ * "Store" data from a page to frontswap and associate it with the page's
+ * swaptype and offset.  Page must be locked and in the swap cache.
+ * If frontswap already contains a page with matching swaptype and
+ * offset, the frontswap implementation may either overwrite the data and
+ * return success or invalidate the page from frontswap and return failure.
+ */
+static inline void __frontswap_clear(struct swap_info_struct *sis,
+				     pgoff_t offset)
+{
+	clear_bit(offset, sis->frontswap_map);
+	atomic_dec(&sis->frontswap_pages);
+}
+
+int __frontswap_store(struct page *page)
+{
+	int ret = -1, dup = 0;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	if (!sis->frontswap_map)
+		return ret;
+	if (frontswap_test(sis, offset))
+		dup = 1;
+	ret = frontswap_ops.store(type, offset, page);
+	if (ret == 0) {
+		if (!dup) {
+			set_bit(offset, sis->frontswap_map);
+			atomic_inc(&sis->frontswap_pages);
+		}
+		inc_frontswap_succ_stores();
+	} else {
+		/*
+		 * A failed store of a duplicate must not leave the stale
+		 * copy behind: the swap device now has the only valid data.
+		 */
+		inc_frontswap_failed_stores();
+		if (dup) {
+			__frontswap_clear(sis, offset);
+			frontswap_ops.invalidate_page(type, offset);
+		}
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_store);
+
+/*
+ * "Get" data from frontswap associated with swaptype and offset that were
+ * specified when the data was put to frontswap and use it to fill the
+ * specified page with data.  Page must be locked and in the swap cache.
+ */
+int __frontswap_load(struct page *page)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	if (frontswap_test(sis, offset))
+		ret = frontswap_ops.load(type, offset, page);
+	if (ret == 0)
+		inc_frontswap_loads();
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_load);
+
+/*
+ * Invalidate any data from frontswap associated with the specified swaptype
+ * and offset so that a subsequent "get" will fail.  Called with swap_lock
+ * held, as the swap slot is being freed.
+ */
+void __frontswap_invalidate_page(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (frontswap_test(sis, offset)) {
+		frontswap_ops.invalidate_page(sis->type, offset);
+		__frontswap_clear(sis, offset);
+		inc_frontswap_invalidates();
+	}
+}
+EXPORT_SYMBOL(__frontswap_invalidate_page);
+
+/*
+ * Called by the backend when it has dropped the data for a page it wrote
+ * back to the swap device itself, so that loads for the slot go to the
+ * device.  @page is the locked swap cache page for the slot.
+ */
+void frontswap_writeback_done(struct page *page)
+{
+	swp_entry_t entry = { .val = page_private(page), };
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	if (frontswap_test(sis, offset))
+		__frontswap_clear(sis, offset);
+}
+EXPORT_SYMBOL(frontswap_writeback_done);
+
+/*
+ * Invalidate all data from frontswap associated with all offsets for the
+ * specified swaptype.  Called on swapoff, once all pages have been
+ * brought back in.
+ */
+void __frontswap_invalidate_area(struct swap_info_struct *sis)
+{
+	if (!sis->frontswap_map)
+		return;
+	frontswap_ops.invalidate_area(sis->type);
+	atomic_set(&sis->frontswap_pages, 0);
+	memset(sis->frontswap_map, 0,
+	       BITS_TO_LONGS(sis->max) * sizeof(long));
+}
+EXPORT_SYMBOL(__frontswap_invalidate_area);
+
+static int __init init_frontswap(void)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *root = debugfs_create_dir("frontswap", NULL);
+
+	if (root == NULL)
+		return -ENXIO;
+	debugfs_create_u64("loads", S_IRUGO, root, &frontswap_loads);
+	debugfs_create_u64("succ_stores", S_IRUGO, root,
+			   &frontswap_succ_stores);
+	debugfs_create_u64("failed_stores", S_IRUGO, root,
+			   &frontswap_failed_stores);
+	debugfs_create_u64("invalidates", S_IRUGO, root,
+			   &frontswap_invalidates);
+#endif
+	return 0;
+}
+
+module_init(init_frontswap);
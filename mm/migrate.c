@@ -563,6 +563,10 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	/* prepare cgroup just returns 0 or -ENOMEM */
 	rc = -EAGAIN;
 
+	if (unlikely(PageTransHuge(page)))
+		if (unlikely(split_huge_page(page)))
+			goto move_newpage;
+
 	if (!trylock_page(page)) {
 		if (!force)
 			goto move_newpage;
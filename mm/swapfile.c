@@ -30,6 +30,7 @@
 #include <linux/capability.h>
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
+#include <linux/frontswap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -583,6 +584,7 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 			swap_list.next = p->type;
 		nr_swap_pages++;
 		p->inuse_pages--;
+		frontswap_invalidate_page(p, offset);
 	}
 
 	return usage;
@@ -905,7 +907,7 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
@@ -1301,6 +1303,17 @@ sector_t map_swap_page(struct page *page, struct block_device **bdev)
 	return map_swap_entry(entry, bdev);
 }
 
+/*
+ * Return the swap_info_struct of the swap cache page's swap area.
+ */
+struct swap_info_struct *page_swap_info(struct page *page)
+{
+	swp_entry_t entry = { .val = page_private(page) };
+
+	BUG_ON(!PageSwapCache(page));
+	return swap_info[swp_type(entry)];
+}
+
 /*
  * Free all of a swapdev's extent information
  */
@@ -1493,6 +1506,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	unsigned long *frontswap_map;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1590,6 +1604,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	if (p->flags & SWP_CONTINUED)
 		free_swap_count_continuations(p);
 
+	frontswap_invalidate_area(p);
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	drain_mmlist();
@@ -1607,10 +1623,13 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	frontswap_map = frontswap_map_get(p);
+	frontswap_map_set(p, NULL);
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(frontswap_map);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1766,6 +1785,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages = 1;
 	unsigned long swapfilepages;
 	unsigned char *swap_map = NULL;
+	unsigned long *frontswap_map = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -1957,6 +1977,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		swap_map[page_nr] = SWAP_MAP_BAD;
 	}
 
+	/* Frontswap simply stays unused on this area if this fails */
+	frontswap_map = frontswap_map_alloc(maxpages);
+
 	error = swap_cgroup_swapon(type, maxpages);
 	if (error)
 		goto bad_swap;
@@ -1991,6 +2014,9 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	frontswap_map_set(p, frontswap_map);
+	frontswap_init(p);
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -2039,6 +2065,7 @@ bad_swap_2:
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(frontswap_map);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -0,0 +1,672 @@
+/*
+ * zswap.c - compressed cache for swap pages
+ *
+ * zswap is a frontswap backend that takes pages that are in the process
+ * of being swapped out and attempts to compress them with LZO into a
+ * dynamically sized pool of kernel memory.  A page that compresses well
+ * never reaches the swap device; reading it back is a decompression
+ * instead of a block I/O.
+ *
+ * The pool grows on demand up to max_pool_percent of RAM.  When it is
+ * full, the least recently stored entries are decompressed back into
+ * the swap cache and written to the real swap device to make room.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/types.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/frontswap.h>
+#include <linux/lzo.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <asm/atomic.h>
+
+/*********************************
+* statistics
+**********************************/
+/* Number of compressed pages currently stored */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+/* Memory used by the compressed pages, in bytes */
+static atomic_long_t zswap_pool_bytes = ATOMIC_LONG_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+static u64 zswap_pool_limit_hit;
+static u64 zswap_written_back_pages;
+static u64 zswap_reject_reclaim_fail;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_reject_kmemcache_fail;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_duplicate_entry;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default, fixed at boot for now) */
+static bool zswap_enabled __read_mostly;
+module_param_named(enabled, zswap_enabled, bool, 0444);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/*
+ * Pages that do not compress to this percentage of PAGE_SIZE or less
+ * are not worth keeping and go straight to the swap device.
+ */
+static unsigned int zswap_max_compression_ratio = 75;
+module_param_named(max_compression_ratio, zswap_max_compression_ratio,
+		   uint, 0644);
+
+/* Number of pool entries written back per store when the pool is full */
+#define ZSWAP_WRITEBACK_BATCH	4
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into the red-black tree for its swap type
+ * lru - links the entry into the writeback order of its swap type,
+ *       oldest first
+ * offset - the swap offset for the entry, the index into the tree
+ * refcount - the number of outstanding references to the entry.  The
+ *            tree holds one reference while the entry is linked into it;
+ *            loads and writeback take another while they work on the
+ *            data outside of the tree lock.
+ * length - the length in bytes of the compressed page data
+ * data - kmalloc'ed buffer holding the compressed page
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	pgoff_t offset;
+	int refcount;
+	unsigned int length;
+	void *data;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects a few things:
+ * - the rbtree
+ * - the lru list
+ * - the refcount field of each entry in the tree
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	struct list_head lru;
+	spinlock_t lock;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+/*********************************
+* helpers
+**********************************/
+static bool zswap_is_full(void)
+{
+	unsigned long pool_pages = atomic_long_read(&zswap_pool_bytes) >>
+				   PAGE_SHIFT;
+
+	return pool_pages > totalram_pages * zswap_max_pool_percent / 100;
+}
+
+/*********************************
+* per-cpu compression buffers
+**********************************/
+static DEFINE_PER_CPU(unsigned char *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_workmem);
+
+/*
+ * Buffers are set up for every possible cpu at init time, so no
+ * hotplug notifier is needed.
+ */
+static int __init zswap_cpu_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		unsigned char *dst;
+		void *work;
+
+		dst = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+		work = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		if (!dst || !work) {
+			kfree(dst);
+			kfree(work);
+			goto cleanup;
+		}
+		per_cpu(zswap_dstmem, cpu) = dst;
+		per_cpu(zswap_workmem, cpu) = work;
+	}
+	return 0;
+
+cleanup:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zswap_dstmem, cpu));
+		kfree(per_cpu(zswap_workmem, cpu));
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		per_cpu(zswap_workmem, cpu) = NULL;
+	}
+	return -ENOMEM;
+}
+
+/*********************************
+* zswap entry functions
+**********************************/
+static struct kmem_cache *zswap_entry_cache;
+
+static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
+{
+	struct zswap_entry *entry;
+
+	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
+	if (!entry)
+		return NULL;
+	entry->refcount = 1;
+	entry->data = NULL;
+	RB_CLEAR_NODE(&entry->rbnode);
+	INIT_LIST_HEAD(&entry->lru);
+	return entry;
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	atomic_long_sub(ksize(entry->data), &zswap_pool_bytes);
+	atomic_dec(&zswap_stored_pages);
+	kfree(entry->data);
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root,
+					   pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that an entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns
+ * -EEXIST.
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			   struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/*
+ * Unlink the entry from the tree and the lru, if it still is linked.
+ * Caller holds the tree lock.
+ */
+static void zswap_entry_unlink(struct zswap_tree *tree,
+			       struct zswap_entry *entry)
+{
+	if (!RB_EMPTY_NODE(&entry->rbnode)) {
+		rb_erase(&entry->rbnode, &tree->rbroot);
+		RB_CLEAR_NODE(&entry->rbnode);
+	}
+	list_del_init(&entry->lru);
+}
+
+/*
+ * Drop a reference, freeing the entry when it was the last one.
+ * Caller holds the tree lock.
+ */
+static void zswap_entry_put(struct zswap_tree *tree,
+			    struct zswap_entry *entry)
+{
+	if (--entry->refcount == 0) {
+		zswap_entry_unlink(tree, entry);
+		zswap_free_entry(entry);
+	}
+}
+
+/*
+ * Unlink the entry and drop the reference the tree held on it.
+ * Caller holds the tree lock.
+ */
+static void zswap_entry_invalidate(struct zswap_tree *tree,
+				   struct zswap_entry *entry)
+{
+	zswap_entry_unlink(tree, entry);
+	zswap_entry_put(tree, entry);
+}
+
+/*********************************
+* compression
+**********************************/
+static void zswap_decompress(struct zswap_entry *entry, struct page *page)
+{
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret;
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+}
+
+/*********************************
+* writeback
+**********************************/
+/*
+ * Write the oldest entry of the tree back to the swap device and remove
+ * it from the pool.  The entry is decompressed into a new swap cache
+ * page, which is then written out asynchronously like any other swap
+ * page under reclaim.
+ *
+ * Returns 0 if an entry was freed, or a negative errno otherwise.
+ */
+static int zswap_writeback_entry(unsigned type, struct zswap_tree *tree)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct zswap_entry *entry;
+	bool page_was_allocated;
+	struct page *page;
+	pgoff_t offset;
+	int ret;
+
+	spin_lock(&tree->lock);
+	if (list_empty(&tree->lru)) {
+		spin_unlock(&tree->lock);
+		return -ENOENT;
+	}
+	entry = list_first_entry(&tree->lru, struct zswap_entry, lru);
+	/* Rotate it, so a failure here moves on to the next entry */
+	list_move_tail(&entry->lru, &tree->lru);
+	entry->refcount++;
+	offset = entry->offset;
+	spin_unlock(&tree->lock);
+
+	page = __read_swap_cache_async(swp_entry(type, offset), GFP_KERNEL,
+				       NULL, 0, &page_was_allocated);
+	if (!page) {
+		/* Out of memory, or the swap entry has been freed */
+		ret = -ENOMEM;
+		goto put;
+	}
+	if (!page_was_allocated) {
+		/* The page is in memory already, nothing to write back */
+		page_cache_release(page);
+		ret = -EEXIST;
+		goto put;
+	}
+
+	/*
+	 * The new swap cache page is locked and pins the swap entry, so no
+	 * store or invalidate can happen for this offset from now on.  But
+	 * the entry may have been invalidated, and the slot reused, before
+	 * we got here: check it is still the current data for the slot.
+	 */
+	spin_lock(&tree->lock);
+	if (zswap_rb_search(&tree->rbroot, offset) != entry) {
+		spin_unlock(&tree->lock);
+		delete_from_swap_cache(page);
+		unlock_page(page);
+		page_cache_release(page);
+		ret = -EAGAIN;
+		goto put;
+	}
+	spin_unlock(&tree->lock);
+
+	zswap_decompress(entry, page);
+	SetPageUptodate(page);
+
+	spin_lock(&tree->lock);
+	zswap_entry_invalidate(tree, entry);
+	zswap_entry_put(tree, entry);
+	spin_unlock(&tree->lock);
+	frontswap_writeback_done(page);
+
+	/* Start writeback, and move the page to the tail of the lru */
+	SetPageReclaim(page);
+	__swap_writepage(page, &wbc);
+	page_cache_release(page);
+	zswap_written_back_pages++;
+	return 0;
+
+put:
+	spin_lock(&tree->lock);
+	zswap_entry_put(tree, entry);
+	spin_unlock(&tree->lock);
+	return ret;
+}
+
+/*
+ * Make room in a full pool.  Returns true if at least one entry was
+ * written back.
+ */
+static bool zswap_shrink(unsigned type, struct zswap_tree *tree)
+{
+	int i, freed = 0;
+
+	for (i = 0; i < ZSWAP_WRITEBACK_BATCH; i++) {
+		if (zswap_writeback_entry(type, tree) == 0)
+			freed++;
+		if (!zswap_is_full())
+			break;
+	}
+	return freed > 0;
+}
+
+/*********************************
+* frontswap hooks
+**********************************/
+/* attempts to compress and store a single page */
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				 struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	unsigned char *dst;
+	size_t dlen;
+	void *data;
+	u8 *src;
+	int ret;
+
+	if (!tree)
+		return -ENODEV;
+
+	/* reclaim space if needed */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		if (!zswap_shrink(type, tree)) {
+			zswap_reject_reclaim_fail++;
+			return -ENOMEM;
+		}
+	}
+
+	/* allocate entry */
+	entry = zswap_entry_cache_alloc(GFP_KERNEL);
+	if (!entry) {
+		zswap_reject_kmemcache_fail++;
+		return -ENOMEM;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_workmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK) {
+		ret = -EINVAL;
+		goto putcpu;
+	}
+	if (dlen > PAGE_SIZE * zswap_max_compression_ratio / 100) {
+		zswap_reject_compress_poor++;
+		ret = -E2BIG;
+		goto putcpu;
+	}
+
+	/* store */
+	data = kmalloc(dlen, __GFP_NORETRY | __GFP_NOWARN | __GFP_NOMEMALLOC);
+	if (!data) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto putcpu;
+	}
+	memcpy(data, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	entry->offset = offset;
+	entry->length = dlen;
+	entry->data = data;
+	atomic_long_add(ksize(data), &zswap_pool_bytes);
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	while (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+		zswap_duplicate_entry++;
+		zswap_entry_invalidate(tree, dupentry);
+	}
+	list_add_tail(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+putcpu:
+	put_cpu_var(zswap_dstmem);
+	kmem_cache_free(zswap_entry_cache, entry);
+	return ret;
+}
+
+/*
+ * returns 0 if the page was successfully decompressed
+ * return -1 on entry not found, e.g. because it was written back
+ */
+static int zswap_frontswap_load(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return -1;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		spin_unlock(&tree->lock);
+		return -1;
+	}
+	entry->refcount++;
+	spin_unlock(&tree->lock);
+
+	zswap_decompress(entry, page);
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(tree, entry);
+	spin_unlock(&tree->lock);
+
+	return 0;
+}
+
+/* frees an entry in zswap */
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry)
+		zswap_entry_invalidate(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/* frees all zswap entries for the given swap type */
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct rb_node *node;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->rbroot)) != NULL)
+		zswap_entry_invalidate(tree,
+			rb_entry(node, struct zswap_entry, rbnode));
+	spin_unlock(&tree->lock);
+}
+
+/*
+ * The tree of a swap type is kept across swapoff, and reused when the
+ * type is enabled again.
+ */
+static void zswap_frontswap_init(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	if (zswap_trees[type])
+		return;
+
+	tree = kmalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("zswap: alloc failed, zswap disabled for swap type %d\n",
+		       type);
+		return;
+	}
+	tree->rbroot = RB_ROOT;
+	INIT_LIST_HEAD(&tree->lru);
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.store = zswap_frontswap_store,
+	.load = zswap_frontswap_load,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init
+};
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static int zswap_pool_bytes_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_pool_bytes);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_bytes_fops, zswap_pool_bytes_get,
+			NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			   zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("reject_reclaim_fail", S_IRUGO,
+			   zswap_debugfs_root, &zswap_reject_reclaim_fail);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			   zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_kmemcache_fail", S_IRUGO,
+			   zswap_debugfs_root, &zswap_reject_kmemcache_fail);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			   zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			   zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			   zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("pool_total_size", S_IRUGO,
+			    zswap_debugfs_root, NULL, &zswap_pool_bytes_fops);
+	debugfs_create_file("stored_pages", S_IRUGO,
+			    zswap_debugfs_root, NULL, &zswap_stored_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init
+**********************************/
+static int __init init_zswap(void)
+{
+	if (!zswap_enabled)
+		return 0;
+
+	pr_info("loading zswap\n");
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache) {
+		pr_err("zswap: entry cache creation failed\n");
+		goto error;
+	}
+	if (zswap_cpu_init()) {
+		pr_err("zswap: per-cpu initialization failed\n");
+		goto cachefail;
+	}
+	frontswap_register_ops(&zswap_frontswap_ops);
+	if (zswap_debugfs_init())
+		pr_warning("zswap: debugfs initialization failed\n");
+	return 0;
+
+cachefail:
+	kmem_cache_destroy(zswap_entry_cache);
+error:
+	return -ENOMEM;
+}
+/* late, but before userspace gets a chance to enable swap */
+late_initcall(init_zswap);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cache for swap pages");
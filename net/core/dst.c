@@ -248,7 +248,7 @@ again:
 
 		if (atomic_dec_and_test(&dst->__refcnt)) {
 			/* We were real parent of this dst, so kill child. */
-			if (nohash)
+			if (nohash || (dst->flags & DST_NOCACHE))
 				goto again;
 		} else {
 			/* Child is still referenced, return it for freeing. */
@@ -268,6 +268,12 @@ void dst_release(struct dst_entry *dst)
 		smp_mb__before_atomic_dec();
                newrefcnt = atomic_dec_return(&dst->__refcnt);
                WARN_ON(newrefcnt < 0);
+		/* Uncached entries are not on any list, free them now. */
+		if (unlikely(dst->flags & DST_NOCACHE) && !newrefcnt) {
+			dst = dst_destroy(dst);
+			if (dst)
+				__dst_free(dst);
+		}
 	}
 }
 EXPORT_SYMBOL(dst_release);
@@ -280,8 +286,7 @@ EXPORT_SYMBOL(dst_release);
  *
  * Commented and originally written by Alexey.
  */
-static inline void dst_ifdown(struct dst_entry *dst, struct net_device *dev,
-			      int unregister)
+void dst_ifdown(struct dst_entry *dst, struct net_device *dev, int unregister)
 {
 	if (dst->ops->ifdown)
 		dst->ops->ifdown(dst, dev, unregister);
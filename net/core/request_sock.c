@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/netdevice.h>
 
 #include <net/request_sock.h>
 
@@ -58,17 +59,86 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	     lopt->max_qlen_log++);
 
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
-	rwlock_init(&queue->syn_wait_lock);
+	seqlock_init(&queue->syn_wait_lock);
 	queue->rskq_accept_head = NULL;
 	lopt->nr_table_entries = nr_table_entries;
 
-	write_lock_bh(&queue->syn_wait_lock);
-	queue->listen_opt = lopt;
-	write_unlock_bh(&queue->syn_wait_lock);
+	write_seqlock_bh(&queue->syn_wait_lock);
+	rcu_assign_pointer(queue->listen_opt, lopt);
+	write_sequnlock_bh(&queue->syn_wait_lock);
 
 	return 0;
 }
 
+void reqsk_free_rcu(struct rcu_head *head)
+{
+	reqsk_free(container_of(head, struct request_sock, rsk_rcu));
+}
+EXPORT_SYMBOL(reqsk_free_rcu);
+
+/*
+ * Puts @req in bucket @hash of the SYN table @lopt, handing the caller's
+ * reference over to the table.  Returns the queue length before the
+ * insertion, or -1 if the listener stopped listening meanwhile, in which
+ * case @req is freed.
+ */
+int reqsk_queue_hash_req(struct request_sock_queue *queue,
+			 struct listen_sock *lopt, u32 hash,
+			 struct request_sock *req, unsigned long timeout)
+{
+	int prev_qlen = -1;
+
+	req->expires = jiffies + timeout;
+	req->retrans = 0;
+	req->sk = NULL;
+	req->rsk_hash = hash;
+
+	write_seqlock(&queue->syn_wait_lock);
+	if (likely(queue->listen_opt == lopt)) {
+		req->dl_next = lopt->syn_table[hash];
+		rcu_assign_pointer(lopt->syn_table[hash], req);
+		prev_qlen = lopt->qlen++;
+		lopt->qlen_young++;
+	}
+	write_sequnlock(&queue->syn_wait_lock);
+
+	if (prev_qlen < 0)
+		reqsk_free(req);
+	return prev_qlen;
+}
+EXPORT_SYMBOL(reqsk_queue_hash_req);
+
+/*
+ * Takes @req out of the SYN table.  Returns false if it was no longer
+ * there, because a racing SYN, ACK or timer got to it first; only the
+ * caller that succeeds may drop the table's reference.
+ */
+bool reqsk_queue_unlink(struct request_sock_queue *queue,
+			struct request_sock *req)
+{
+	struct listen_sock *lopt;
+	struct request_sock **prev;
+	bool found = false;
+
+	write_seqlock(&queue->syn_wait_lock);
+	lopt = queue->listen_opt;
+	if (lopt != NULL) {
+		for (prev = &lopt->syn_table[req->rsk_hash]; *prev != NULL;
+		     prev = &(*prev)->dl_next) {
+			if (*prev == req) {
+				*prev = req->dl_next;
+				reqsk_queue_removed(lopt, req);
+				found = true;
+				break;
+			}
+		}
+	}
+	write_sequnlock(&queue->syn_wait_lock);
+
+	return found;
+}
+EXPORT_SYMBOL(reqsk_queue_unlink);
+
 void __reqsk_queue_destroy(struct request_sock_queue *queue)
 {
 	struct listen_sock *lopt;
@@ -94,10 +164,10 @@ static inline struct listen_sock *reqsk_queue_yank_listen_sk(
 {
 	struct listen_sock *lopt;
 
-	write_lock_bh(&queue->syn_wait_lock);
+	write_seqlock_bh(&queue->syn_wait_lock);
 	lopt = queue->listen_opt;
-	queue->listen_opt = NULL;
-	write_unlock_bh(&queue->syn_wait_lock);
+	rcu_assign_pointer(queue->listen_opt, NULL);
+	write_sequnlock_bh(&queue->syn_wait_lock);
 
 	return lopt;
 }
@@ -109,6 +179,11 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 	size_t lopt_size = sizeof(struct listen_sock) +
 		lopt->nr_table_entries * sizeof(struct request_sock *);
 
+	/* SYNs processed without the listener lock may still be looking at
+	 * the table.  Once they are done nobody else can find it.
+	 */
+	synchronize_net();
+
 	if (lopt->qlen != 0) {
 		unsigned int i;
 
@@ -118,7 +193,7 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 			while ((req = lopt->syn_table[i]) != NULL) {
 				lopt->syn_table[i] = req->dl_next;
 				lopt->qlen--;
-				reqsk_free(req);
+				reqsk_put(req);
 			}
 		}
 	}
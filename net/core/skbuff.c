@@ -347,6 +347,8 @@ static void skb_release_data(struct sk_buff *skb)
 				put_page(skb_shinfo(skb)->frags[i].page);
 		}
 
+		skb_zcopy_clear(skb, true);
+
 		if (skb_has_frags(skb))
 			skb_drop_fraglist(skb);
 
@@ -550,6 +552,10 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->protocol		= old->protocol;
 	new->mark		= old->mark;
 	new->skb_iif		= old->skb_iif;
+	new->rxhash		= old->rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 	__nf_copy(new, old);
 #if defined(CONFIG_NETFILTER_XT_TARGET_TRACE) || \
     defined(CONFIG_NETFILTER_XT_TARGET_TRACE_MODULE)
@@ -768,6 +774,7 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zerocopy_clone(n, skb);
 	}
 
 	if (skb_has_frags(skb)) {
@@ -836,6 +843,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	if (skb_has_frags(skb))
 		skb_clone_fraglist(skb);
 
+	/* The copied skb_shared_info references the user pages too */
+	if (skb_zcopy(skb))
+		sock_zerocopy_get(skb_uarg(skb));
+
 	skb_release_data(skb);
 
 	off = (data + nhead) - skb->head;
@@ -2084,6 +2095,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	skb_zerocopy_clone(skb1, skb);
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2126,6 +2138,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* An skb can pin the user pages of one send call only */
+	if (skb_zcopy(skb) && skb_zcopy(skb) != skb_zcopy(tgt))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2596,6 +2612,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zerocopy_clone(nskb, skb);
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -3008,6 +3025,256 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+/*
+ * MSG_ZEROCOPY: the completion state of a send call lives in the cb[]
+ * of the skb that is eventually queued on the error queue, so the
+ * notification cannot fail for lack of memory once the data is out.
+ */
+#define skb_from_uarg(uarg) \
+	container_of((void *)(uarg), struct sk_buff, cb)
+
+static void sock_zerocopy_callback(struct ubuf_info *uarg, bool success);
+
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	skb = sock_omalloc(sk, 0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+	uarg = (void *)skb->cb;
+
+	uarg->callback = sock_zerocopy_callback;
+	uarg->id = ((u32)atomic_inc_return(&sk->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+/* Merge a completion into the tail notification if the ranges touch */
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len,
+				       u8 code)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+	u64 sum_len;
+
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    serr->ee.ee_code != code)
+		return false;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	sum_len = old_hi - old_lo + 1ULL + len;
+	if (sum_len >= (1ULL << 32))
+		return false;
+
+	if (lo != old_hi + 1)
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+static void sock_zerocopy_callback(struct ubuf_info *uarg, bool success)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+	u8 code;
+
+	/* if !len, there was only 1 call, and it was aborted
+	 * so do not queue a completion notification
+	 */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+	code = success ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = lo;
+	serr->ee.ee_data = hi;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || !skb_zerocopy_notify_extend(tail, lo, len, code)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		uarg->callback(uarg, uarg->zerocopy);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* The send call failed before any data was queued: give back its id */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		atomic_dec(&sk->sk_zckey);
+		uarg->len--;
+
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/**
+ *	skb_zerocopy_iter_stream - append user pages to a stream skb
+ *	@sk: socket the data is charged to
+ *	@skb: buffer to append to
+ *	@from: user buffer
+ *	@len: maximum number of bytes to append
+ *	@uarg: completion state of the send call
+ *
+ *	Pins the user pages backing @from and adds them as page fragments
+ *	of @skb, for as many bytes as the free fragment slots allow. The
+ *	pages stay pinned until the last skb referencing them is freed,
+ *	at which point @uarg reports the completion.
+ *
+ *	Returns the number of bytes appended, -EMSGSIZE if @skb has no
+ *	free fragment slot, -EEXIST if @skb already pins the pages of
+ *	another send call, or -EFAULT.
+ */
+int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+			     const void __user *from, int len,
+			     struct ubuf_info *uarg)
+{
+	struct ubuf_info *orig_uarg = skb_zcopy(skb);
+	unsigned long addr = (unsigned long)from;
+	int i = skb_shinfo(skb)->nr_frags;
+	int copied = 0;
+
+	if (orig_uarg && uarg != orig_uarg)
+		return -EEXIST;
+
+	if (i == MAX_SKB_FRAGS)
+		return -EMSGSIZE;
+
+	while (copied < len && i < MAX_SKB_FRAGS) {
+		struct page *pages[MAX_SKB_FRAGS];
+		int off = addr & ~PAGE_MASK;
+		int n, j;
+
+		n = DIV_ROUND_UP(off + len - copied, PAGE_SIZE);
+		if (n > MAX_SKB_FRAGS - i)
+			n = MAX_SKB_FRAGS - i;
+
+		n = get_user_pages_fast(addr, n, 0, pages);
+		if (n <= 0)
+			break;
+
+		for (j = 0; j < n; j++) {
+			int size = min_t(int, PAGE_SIZE - off, len - copied);
+
+			if (skb_can_coalesce(skb, i, pages[j], off)) {
+				skb_shinfo(skb)->frags[i - 1].size += size;
+				put_page(pages[j]);
+			} else {
+				skb_fill_page_desc(skb, i++, pages[j],
+						   off, size);
+			}
+
+			addr += size;
+			copied += size;
+			off = 0;
+		}
+	}
+
+	if (!copied)
+		return -EFAULT;
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	sk->sk_wmem_queued += copied;
+	sk_mem_charge(sk, copied);
+
+	skb_zcopy_set(skb, uarg);
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_stream);
+
+/**
+ *	skb_copy_ubufs - replace zerocopy user pages by kernel copies
+ *	@skb: buffer to work on
+ *	@gfp_mask: allocation priority
+ *
+ *	Copies the page fragments of @skb into freshly allocated pages and
+ *	drops its reference on the user pages, reporting the send call as
+ *	copied. A cloned @skb gets a private &skb_shared_info first.
+ */
+int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	int num_frags = skb_shinfo(skb)->nr_frags;
+	struct page *pages[MAX_SKB_FRAGS];
+	int i;
+
+	if (skb_shared(skb) ||
+	    (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, gfp_mask)))
+		return -EINVAL;
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+		u8 *vaddr;
+
+		pages[i] = alloc_page(gfp_mask);
+		if (!pages[i]) {
+			while (--i >= 0)
+				put_page(pages[i]);
+			return -ENOMEM;
+		}
+
+		vaddr = kmap_skb_frag(f);
+		memcpy(page_address(pages[i]), vaddr + f->page_offset,
+		       f->size);
+		kunmap_skb_frag(vaddr);
+	}
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+
+		put_page(f->page);
+		f->page = pages[i];
+		f->page_offset = 0;
+	}
+
+	skb_zcopy_clear(skb, false);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_copy_ubufs);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
@@ -138,6 +138,39 @@ static const struct
 
 /* Release a nexthop info record */
 
+static void free_nh_exceptions(struct fib_nh *nh)
+{
+	struct fnhe_hash_bucket *hash = nh->nh_exceptions;
+	int i;
+
+	if (!hash)
+		return;
+
+	for (i = 0; i < FNHE_HASH_SIZE; i++) {
+		struct fib_nh_exception *fnhe, *next;
+
+		for (fnhe = hash[i].chain; fnhe; fnhe = next) {
+			next = fnhe->fnhe_next;
+			kfree(fnhe);
+		}
+	}
+	kfree(hash);
+	nh->nh_exceptions = NULL;
+}
+
+static void free_nh_rth_input(struct fib_nh *nh)
+{
+	int i;
+
+	for (i = 0; i < NH_RTH_INPUT_SLOTS; i++) {
+		struct rtable *rt = nh->nh_rth_input[i];
+
+		if (rt)
+			call_rcu_bh(&rt->u.dst.rcu_head, dst_rcu_free);
+		nh->nh_rth_input[i] = NULL;
+	}
+}
+
 void free_fib_info(struct fib_info *fi)
 {
 	if (fi->fib_dead == 0) {
@@ -148,6 +181,8 @@ void free_fib_info(struct fib_info *fi)
 		if (nh->nh_dev)
 			dev_put(nh->nh_dev);
 		nh->nh_dev = NULL;
+		free_nh_exceptions(nh);
+		free_nh_rth_input(nh);
 	} endfor_nexthops(fi);
 	fib_info_cnt--;
 	release_net(fi->fib_net);
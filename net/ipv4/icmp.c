@@ -237,16 +237,14 @@ static inline void icmp_xmit_unlock(struct sock *sk)
  *	This function is generic and could be used for other purposes
  *	too. It uses a Token bucket filter as suggested by Alexey Kuznetsov.
  *
- *	Note that the same dst_entry fields are modified by functions in
- *	route.c too, but these work for packet destinations while xrlim_allow
- *	works for icmp destinations. This means the rate limiting information
- *	for one "ip object" is shared - and these ICMPs are twice limited:
- *	by source and by destination.
- *
  *	RFC 1812: 4.3.2.8 SHOULD be able to limit error message rate
  *			  SHOULD allow setting of rate limits
  *
- * 	Shared between ICMPv4 and ICMPv6.
+ *	Only used by ICMPv6 now.  ICMPv4 routes are not kept per destination:
+ *	output routes are built per lookup, forwarding routes are shared by
+ *	everything behind a nexthop, and learned PMTUs and redirects sit in
+ *	the nexthop exceptions.  The rate state lives in the inet_peer
+ *	instead (see inet_peer_xrlim_allow()).
  */
 #define XRLIM_BURST_FACTOR 6
 int xrlim_allow(struct dst_entry *dst, int timeout)
@@ -284,9 +282,16 @@ static inline int icmpv4_xrlim_allow(struct net *net, struct rtable *rt,
 	if (dst->dev && (dst->dev->flags&IFF_LOOPBACK))
 		goto out;
 
-	/* Limit if icmp type is enabled in ratemask. */
-	if ((1 << type) & net->ipv4.sysctl_icmp_ratemask)
-		rc = xrlim_allow(dst, net->ipv4.sysctl_icmp_ratelimit);
+	/* Limit if icmp type is enabled in ratemask.  The route does
+	 * not belong to this destination alone, so the state lives in
+	 * the destination's inet_peer.
+	 */
+	if ((1 << type) & net->ipv4.sysctl_icmp_ratemask) {
+		if (!rt->peer)
+			rt_bind_peer(rt, 1);
+		rc = inet_peer_xrlim_allow(rt->peer,
+					   net->ipv4.sysctl_icmp_ratelimit);
+	}
 out:
 	return rc;
 }
@@ -376,6 +381,7 @@ static void icmp_reply(struct icmp_bxm *icmp_param, struct sk_buff *skb)
 	daddr = ipc.addr = rt->rt_src;
 	ipc.opt = NULL;
 	ipc.shtx.flags = 0;
+	ipc.gso_size = 0;
 	if (icmp_param->replyopts.optlen) {
 		ipc.opt = &icmp_param->replyopts;
 		if (ipc.opt->srr)
@@ -535,6 +541,7 @@ void icmp_send(struct sk_buff *skb_in, int type, int code, __be32 info)
 	ipc.addr = iph->saddr;
 	ipc.opt = &icmp_param.replyopts;
 	ipc.shtx.flags = 0;
+	ipc.gso_size = 0;
 
 	{
 		struct flowi fl = {
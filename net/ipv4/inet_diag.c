@@ -631,9 +631,9 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 
 	entry.family = sk->sk_family;
 
-	read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+	rcu_read_lock();
 
-	lopt = icsk->icsk_accept_queue.listen_opt;
+	lopt = rcu_dereference(icsk->icsk_accept_queue.listen_opt);
 	if (!lopt || !lopt->qlen)
 		goto out;
 
@@ -644,14 +644,19 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 	}
 
 	for (j = s_j; j < lopt->nr_table_entries; j++) {
-		struct request_sock *req, *head = lopt->syn_table[j];
+		struct request_sock *req, *head;
 
+		head = rcu_dereference(lopt->syn_table[j]);
 		reqnum = 0;
-		for (req = head; req; reqnum++, req = req->dl_next) {
+		for (req = head; req;
+		     reqnum++, req = rcu_dereference(req->dl_next)) {
 			struct inet_request_sock *ireq = inet_rsk(req);
 
 			if (reqnum < s_reqnum)
 				continue;
+			/* Moved to the accept queue behind our back. */
+			if (req->sk)
+				continue;
 			if (r->id.idiag_dport != ireq->rmt_port &&
 			    r->id.idiag_dport)
 				continue;
@@ -690,7 +695,7 @@ static int inet_diag_dump_reqs(struct sk_buff *skb, struct sock *sk,
 	}
 
 out:
-	read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+	rcu_read_unlock();
 
 	return err;
 }
@@ -116,6 +116,9 @@
    Alexey Kuznetsov.
  */
 
+#define IPGRE_FEATURES	(NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_HIGHDMA | \
+			 NETIF_F_GSO_SOFTWARE)
+
 static struct rtnl_link_ops ipgre_link_ops __read_mostly;
 static int ipgre_tunnel_init(struct net_device *dev);
 static void ipgre_tunnel_setup(struct net_device *dev);
@@ -601,6 +604,18 @@ static int ipgre_rcv(struct sk_buff *skb)
 		skb->mac_header = skb->network_header;
 		__pskb_pull(skb, offset);
 		skb_postpull_rcsum(skb, skb_transport_header(skb), offset);
+		/* A packet merged by GRO is no longer encapsulated.  A clone
+		 * shares its shinfo, so take a private copy before clearing.
+		 */
+		if (skb_is_gso(skb)) {
+			if (skb_cloned(skb) &&
+			    pskb_expand_head(skb, 0, 0, GFP_ATOMIC)) {
+				stats->rx_dropped++;
+				goto drop;
+			}
+			iph = ip_hdr(skb);
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+		}
 		skb->pkt_type = PACKET_HOST;
 #ifdef CONFIG_NET_IPGRE_BROADCAST
 		if (ipv4_is_multicast(iph->daddr)) {
@@ -772,7 +787,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if ((old_iph->frag_off&htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -792,7 +807,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU && !skb_is_gso(skb) &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu, dev);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -810,10 +826,21 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			tunnel->err_count = 0;
 	}
 
+	/* Only GSO packets keep a partial checksum through the tunnel: the
+	 * outer device would not find the inner transport header.
+	 */
+	if (skb->ip_summed == CHECKSUM_PARTIAL && !skb_is_gso(skb) &&
+	    skb_checksum_help(skb)) {
+		ip_rt_put(rt);
+		goto tx_error;
+	}
+
 	max_headroom = LL_RESERVED_SPACE(tdev) + gre_hlen;
 
+	/* GSO packets get SKB_GSO_GRE, so their shinfo must be our own */
 	if (skb_headroom(skb) < max_headroom || skb_shared(skb)||
-	    (skb_cloned(skb) && !skb_clone_writable(skb, 0))) {
+	    (skb_cloned(skb) &&
+	     (skb_is_gso(skb) || !skb_clone_writable(skb, 0)))) {
 		struct sk_buff *new_skb = skb_realloc_headroom(skb, max_headroom);
 		if (!new_skb) {
 			ip_rt_put(rt);
@@ -879,10 +906,15 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		}
 		if (tunnel->parms.o_flags&GRE_CSUM) {
 			*ptr = 0;
-			*(__sum16*)ptr = ip_compute_csum((void*)(iph+1), skb->len - sizeof(struct iphdr));
+			/* Filled in for each segment by ipgre_gso_segment() */
+			if (!skb_is_gso(skb))
+				*(__sum16*)ptr = ip_compute_csum((void*)(iph+1), skb->len - sizeof(struct iphdr));
 		}
 	}
 
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
 	nf_reset(skb);
 
 	IPTUNNEL_XMIT();
@@ -949,6 +981,14 @@ static int ipgre_tunnel_bind_dev(struct net_device *dev)
 	dev->needed_headroom = addend + hlen;
 	mtu -= dev->hard_header_len + addend;
 
+	/* Segmentation is done by ipgre_gso_segment() below the tunnel,
+	 * which cannot give each segment its own sequence number.
+	 */
+	if (tunnel->parms.o_flags&GRE_SEQ)
+		dev->features &= ~IPGRE_FEATURES;
+	else
+		dev->features |= IPGRE_FEATURES;
+
 	if (mtu < 68)
 		mtu = 68;
 
@@ -1284,9 +1324,248 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 }
 
 
+/*
+ *	Offloads for encapsulated traffic.
+ *
+ *	GRO merges GRE packets carrying TCP as long as the GRE header of
+ *	the flow (flags, protocol and key) stays the same; the inner packet
+ *	is handed to the GRO handler of its own protocol, so the TCP rules
+ *	apply unchanged.  Checksummed and sequenced GRE is left alone: the
+ *	merged packet would carry a wrong checksum and sequence numbers
+ *	must be seen by the tunnel one by one.
+ *
+ *	GSO does the reverse: the inner packet is segmented and the outer
+ *	headers are copied in front of every segment.
+ */
+
+static inline int ipgre_opt_len(__be16 flags)
+{
+	return ((flags & GRE_CSUM) ? 4 : 0) + ((flags & GRE_KEY) ? 4 : 0) +
+	       ((flags & GRE_SEQ) ? 4 : 0);
+}
+
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct packet_type *ptype;
+	__be16 *greh;
+	__be16 type;
+	unsigned int grehlen;
+	unsigned int hlen;
+	unsigned int off;
+	int ip_summed;
+	int flush = 1;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (greh[0] & (GRE_CSUM | GRE_SEQ | GRE_ROUTING | GRE_VERSION))
+		goto out;
+
+	grehlen = 4 + ipgre_opt_len(greh[0]);
+	type = greh[1];
+	if (type == htons(ETH_P_TEB))
+		grehlen += ETH_HLEN;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (type == htons(ETH_P_TEB))
+		type = ((struct ethhdr *)((u8 *)greh + grehlen - ETH_HLEN))->h_proto;
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(type);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* Flags, protocol, key and the inner MAC header must match */
+		if (memcmp(greh, p->data + off, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, grehlen);
+
+	/* The inner handlers expect the checksum to cover what follows
+	 * them.  NICs rarely look inside GRE, so the inner packet is
+	 * verified here when nobody did; TCP then marks it as done.
+	 */
+	csum = skb->csum;
+	ip_summed = skb->ip_summed;
+	if (ip_summed == CHECKSUM_NONE) {
+		skb->csum = skb_checksum(skb, skb_gro_offset(skb),
+					 skb_gro_len(skb), 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+	} else
+		skb_postpull_rcsum(skb, greh, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->ip_summed = ip_summed;
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	__be16 *greh = (__be16 *)(skb->data + nhoff);
+	struct packet_type *ptype;
+	unsigned int grehlen;
+	__be16 type;
+	int err = -ENOENT;
+
+	grehlen = 4 + ipgre_opt_len(greh[0]);
+	type = greh[1];
+	if (type == htons(ETH_P_TEB)) {
+		type = ((struct ethhdr *)((u8 *)greh + grehlen))->h_proto;
+		grehlen += ETH_HLEN;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(type);
+	if (ptype)
+		err = ptype->gro_complete(skb, nhoff + grehlen);
+	rcu_read_unlock();
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
+static int ipgre_gso_send_check(struct sk_buff *skb)
+{
+	if (!(skb_shinfo(skb)->gso_type & SKB_GSO_GRE))
+		return -EINVAL;
+	return 0;
+}
+
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *seg;
+	__be16 protocol = skb->protocol;
+	int mac_len = skb->mac_len;
+	int grehlen, tnl_hlen;
+	int inner_mac_len = 0;
+	int enc_features;
+	__be16 *greh;
+	__be16 type;
+	int csum;
+
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_TCPV6 |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_GRE) ||
+		     !(skb_shinfo(skb)->gso_type & SKB_GSO_GRE)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, 4)))
+		goto out;
+
+	greh = (__be16 *)skb->data;
+	if (greh[0] & (GRE_SEQ | GRE_ROUTING | GRE_VERSION))
+		goto out;
+
+	grehlen = 4 + ipgre_opt_len(greh[0]);
+	if (greh[1] == htons(ETH_P_TEB))
+		inner_mac_len = ETH_HLEN;
+
+	if (unlikely(!pskb_may_pull(skb, grehlen + inner_mac_len)))
+		goto out;
+
+	greh = (__be16 *)skb->data;
+	csum = greh[0] & GRE_CSUM;
+	type = inner_mac_len ?
+	       ((struct ethhdr *)(skb->data + grehlen))->h_proto : greh[1];
+
+	/* Outer MAC, IP and GRE headers, copied in front of each segment */
+	tnl_hlen = skb->data + grehlen - skb_mac_header(skb);
+
+	/* Only a device that checksums at csum_start can finish the inner
+	 * checksum; the GRE checksum needs the inner one done anyway.
+	 */
+	enc_features = features;
+	if (csum || !(features & NETIF_F_GEN_CSUM))
+		enc_features &= ~NETIF_F_ALL_CSUM;
+
+	__skb_pull(skb, grehlen);
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, inner_mac_len);
+	skb->protocol = type;
+	skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
+	segs = skb_gso_segment(skb, enc_features);
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	skb->protocol = protocol;
+	__skb_push(skb, grehlen);
+	skb_set_mac_header(skb, grehlen - tnl_hlen);
+	skb_set_network_header(skb, grehlen - tnl_hlen + mac_len);
+	skb_reset_transport_header(skb);
+
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	for (seg = segs; seg; seg = seg->next) {
+		/* skb_segment() kept the headroom of the original */
+		__skb_push(seg, tnl_hlen);
+		skb_copy_to_linear_data(seg, skb_mac_header(skb), tnl_hlen);
+		skb_reset_mac_header(seg);
+		skb_set_network_header(seg, mac_len);
+		skb_set_transport_header(seg, tnl_hlen - grehlen);
+		seg->mac_len = mac_len;
+		seg->protocol = protocol;
+
+		if (csum) {
+			__sum16 *pcsum;
+
+			pcsum = (__sum16 *)(skb_transport_header(seg) + 4);
+			*pcsum = 0;
+			*pcsum = csum_fold(skb_checksum(seg, tnl_hlen - grehlen,
+							seg->len - tnl_hlen +
+							grehlen, 0));
+		}
+	}
+
+out:
+	return segs;
+}
+
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_send_check	=	ipgre_gso_send_check,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
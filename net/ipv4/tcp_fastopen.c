@@ -0,0 +1,130 @@
+/*
+ * TCP Fast Open: carry data in the SYN, authorized by a server cookie.
+ *
+ * The server hands out a cookie derived from the client and server
+ * addresses and a local secret.  A client presenting it in a later SYN
+ * may have the data in that SYN delivered to the application before the
+ * three-way handshake completes.  The client remembers cookies per
+ * destination in the inet_peer cache.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/seqlock.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+static u32 tcp_fastopen_secret[16 - 2 + SHA_DIGEST_WORDS] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + SHA_DIGEST_WORDS + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+/* Serializes cookie updates in the inet_peer cache */
+static DEFINE_SEQLOCK(tcp_fastopen_seqlock);
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+/* Computes the Fast Open cookie for a client address @saddr talking to
+ * the local address @daddr.  Called from softirq context.
+ */
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 2, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + SHA_DIGEST_WORDS);
+
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+static struct inet_peer *tcp_fastopen_get_peer(struct sock *sk, int create)
+{
+	if (sk->sk_family != AF_INET)
+		return NULL;
+	return inet_getpeer(inet_sk(sk)->inet_daddr, create);
+}
+
+/* Looks up the cookie and MSS cached for the destination of @sk.  Both
+ * are left untouched if nothing is cached.
+ */
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer = tcp_fastopen_get_peer(sk, 0);
+	unsigned int seq;
+
+	if (peer == NULL)
+		return;
+
+	do {
+		seq = read_seqbegin(&tcp_fastopen_seqlock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		if (peer->tcp_fastopen_cookie_len > 0) {
+			cookie->len = peer->tcp_fastopen_cookie_len;
+			memcpy(cookie->val, peer->tcp_fastopen_cookie,
+			       cookie->len);
+		}
+	} while (read_seqretry(&tcp_fastopen_seqlock, seq));
+
+	inet_putpeer(peer);
+}
+
+/* Records the MSS and, if one was received, the cookie from a SYN-ACK. */
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	struct inet_peer *peer = tcp_fastopen_get_peer(sk, 1);
+
+	if (peer == NULL)
+		return;
+
+	write_seqlock_bh(&tcp_fastopen_seqlock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0) {
+		peer->tcp_fastopen_cookie_len = cookie->len;
+		memcpy(peer->tcp_fastopen_cookie, cookie->val, cookie->len);
+	}
+	write_sequnlock_bh(&tcp_fastopen_seqlock);
+
+	inet_putpeer(peer);
+}
+
+/* Drops the request a passive Fast Open child kept for retransmitting
+ * its SYN-ACK, and its slot in the listener's Fast Open queue.  Called
+ * once the handshake completes or the child goes away.
+ */
+void tcp_fastopen_release(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct request_sock *req = tp->fastopen_rsk;
+	struct sock *lsk;
+
+	if (req == NULL)
+		return;
+
+	tp->fastopen_rsk = NULL;
+	lsk = tcp_rsk(req)->listener;
+	atomic_dec(&inet_csk(lsk)->icsk_accept_queue.fastopen_qlen);
+	sock_put(lsk);
+	reqsk_free(req);
+}
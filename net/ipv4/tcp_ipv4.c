@@ -71,6 +71,7 @@
 #include <net/timewait_sock.h>
 #include <net/xfrm.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -439,12 +440,12 @@ void tcp_v4_err(struct sk_buff *icmp_skb, u32 info)
 	}
 
 	switch (sk->sk_state) {
-		struct request_sock *req, **prev;
+		struct request_sock *req;
 	case TCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 
-		req = inet_csk_search_req(sk, &prev, th->dest,
+		req = inet_csk_search_req(sk, th->dest,
 					  iph->daddr, iph->saddr);
 		if (!req)
 			goto out;
@@ -456,6 +457,7 @@ void tcp_v4_err(struct sk_buff *icmp_skb, u32 info)
 
 		if (seq != tcp_rsk(req)->snt_isn) {
 			NET_INC_STATS_BH(net, LINUX_MIB_OUTOFWINDOWICMPS);
+			reqsk_put(req);
 			goto out;
 		}
 
@@ -465,7 +467,8 @@ void tcp_v4_err(struct sk_buff *icmp_skb, u32 info)
 		 * created socket, and POSIX does not want network
 		 * errors returned from accept().
 		 */
-		inet_csk_reqsk_queue_drop(sk, req, prev);
+		inet_csk_reqsk_queue_drop(sk, req);
+		reqsk_put(req);
 		goto out;
 
 	case TCP_SYN_SENT:
@@ -1211,10 +1214,128 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/* Decide whether a SYN may open a Fast Open child right away. Fills in
+ * @valid_foc with the cookie to return in the SYN-ACK, if any.
+ */
+static int tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			      struct tcp_fastopen_cookie *foc,
+			      struct tcp_fastopen_cookie *valid_foc)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    queue->fastopen_max_qlen <= 0 || foc->len < 0)
+		return 0;
+
+	if (atomic_read(&queue->fastopen_qlen) >= queue->fastopen_max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return 0;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+				valid_foc);
+
+	if (foc->len == TCP_FASTOPEN_COOKIE_SIZE &&
+	    !memcmp(foc->val, valid_foc->val, foc->len)) {
+		/* The client already has this cookie, don't resend it. */
+		valid_foc->len = -1;
+		return 1;
+	}
+
+	if (foc->len == 0)
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+	else
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	return 0;
+}
+
+/* Create a child socket straight from a SYN carrying a valid Fast Open
+ * cookie, queue the data in the SYN to it and put it on the accept queue,
+ * so the application sees the request one RTT earlier. @req stays with
+ * the child, which retransmits the SYN-ACK until the handshake completes;
+ * the accept queue gets a request of its own.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst,
+				    struct request_values *rvp)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct request_sock *acc_req;
+	struct sk_buff *data = NULL;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	acc_req = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (acc_req == NULL) {
+		dst_release(dst);
+		goto fail;
+	}
+
+	req->retrans = 0;
+	req->sk = NULL;
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (child == NULL) {
+		__reqsk_free(acc_req);
+		goto fail;
+	}
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	/* Hold the listener so that the child can still account for itself
+	 * in the listener's Fast Open queue after the listener is closed.
+	 */
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+	atomic_inc(&queue->fastopen_qlen);
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	/* Queue the data carried in the SYN. If we cannot, the SYN-ACK below
+	 * simply does not acknowledge it and the client will resend it.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1)
+		data = skb_clone(skb, GFP_ATOMIC);
+	if (data != NULL) {
+		skb_dst_drop(data);
+		__skb_pull(data, tcp_hdr(data)->doff * 4);
+		skb_set_owner_r(data, child);
+		__skb_queue_tail(&child->sk_receive_queue, data);
+		tp->rcv_nxt = tp->rcv_wup = TCP_SKB_CB(data)->end_seq;
+		tp->syn_data_acked = 1;
+	}
+	tcp_rsk(req)->rcv_nxt = tp->rcv_nxt;
+
+	__tcp_v4_send_synack(sk, NULL, req, rvp);
+
+	/* Activate the retrans timer so that SYNACK can be retransmitted.
+	 * The request socket is not added to the SYN table of the parent
+	 * because it's been added to the accept queue directly.
+	 */
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, acc_req, child);
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+	return 0;
+
+fail:
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	return -1;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1265,7 +1386,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0, &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1302,6 +1423,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 		goto drop_and_release;
 	}
 	tmp_ext.cookie_in_always = tp->rx_opt.cookie_in_always;
+	tmp_ext.fastopen_cookie = &valid_foc;
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1373,6 +1495,13 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	if (!want_cookie && tcp_fastopen_check(sk, skb, &foc, &valid_foc)) {
+		if (tcp_v4_conn_req_fastopen(sk, skb, req, dst,
+					     (struct request_values *)&tmp_ext))
+			goto drop_and_free;
+		return 0;
+	}
+
 	if (__tcp_v4_send_synack(sk, dst, req,
 				 (struct request_values *)&tmp_ext) ||
 	    want_cookie)
@@ -1479,12 +1608,16 @@ static struct sock *tcp_v4_hnd_req(struct sock *sk, struct sk_buff *skb)
 	struct tcphdr *th = tcp_hdr(skb);
 	const struct iphdr *iph = ip_hdr(skb);
 	struct sock *nsk;
-	struct request_sock **prev;
 	/* Find possible connection requests. */
-	struct request_sock *req = inet_csk_search_req(sk, &prev, th->source,
+	struct request_sock *req = inet_csk_search_req(sk, th->source,
 						       iph->saddr, iph->daddr);
-	if (req)
-		return tcp_check_req(sk, skb, req, prev);
+	if (req) {
+		nsk = tcp_check_req(sk, skb, req);
+		/* A new child took our reference along to the accept queue */
+		if (nsk == NULL || nsk == sk)
+			reqsk_put(req);
+		return nsk;
+	}
 
 	nsk = inet_lookup_established(sock_net(sk), &tcp_hashinfo, iph->saddr,
 			th->source, iph->daddr, th->dest, inet_iif(skb));
@@ -1550,6 +1683,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 #endif
 
 	if (sk->sk_state == TCP_ESTABLISHED) { /* Fast path */
+		sock_rps_save_rxhash(sk, skb->rxhash);
 		TCP_CHECK_TIMER(sk);
 		if (tcp_rcv_established(sk, skb, tcp_hdr(skb), skb->len)) {
 			rsk = sk;
@@ -1568,6 +1702,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 			goto discard;
 
 		if (nsk != sk) {
+			sock_rps_save_rxhash(nsk, skb->rxhash);
 			if (tcp_child_process(sk, nsk, skb)) {
 				rsk = nsk;
 				goto reset;
@@ -1600,6 +1735,53 @@ csum_err:
 	goto discard;
 }
 
+/* A pure SYN for a listener only touches the SYN table, which has its
+ * own lock, so it can be handled without the listener lock.  Listeners
+ * with MD5 keys, cookie transactions or server side Fast Open still go
+ * through the socket lock.
+ */
+static inline int tcp_v4_syn_lockless(struct sock *sk, const struct tcphdr *th)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (sk->sk_state != TCP_LISTEN || !th->syn || th->ack || th->rst)
+		return 0;
+#ifdef CONFIG_TCP_MD5SIG
+	if (tp->md5sig_info)
+		return 0;
+#endif
+	if (tp->cookie_values)
+		return 0;
+	if ((sysctl_tcp_fastopen & TFO_SERVER_ENABLE) &&
+	    inet_csk(sk)->icsk_accept_queue.fastopen_max_qlen > 0)
+		return 0;
+	return 1;
+}
+
+static int tcp_v4_syn_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	struct sock *nsk;
+
+	if (skb->len < tcp_hdrlen(skb) || tcp_checksum_complete(skb)) {
+		TCP_INC_STATS_BH(sock_net(sk), TCP_MIB_INERRS);
+		goto discard;
+	}
+
+	nsk = tcp_v4_hnd_req(sk, skb);
+	if (nsk == sk) {
+		tcp_v4_conn_request(sk, skb);
+	} else if (nsk) {
+		sock_rps_save_rxhash(nsk, skb->rxhash);
+		if (tcp_child_process(sk, nsk, skb))
+			tcp_v4_send_reset(nsk, skb);
+		else
+			return 0;
+	}
+discard:
+	kfree_skb(skb);
+	return 0;
+}
+
 /*
  *	From tcp_input.c
  */
@@ -1660,8 +1842,15 @@ process:
 	if (sk_filter(sk, skb))
 		goto discard_and_relse;
 
+	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
+	if (tcp_v4_syn_lockless(sk, th)) {
+		ret = tcp_v4_syn_rcv(sk, skb);
+		sock_put(sk);
+		return ret;
+	}
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1720,6 +1909,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1837,6 +2027,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	skb_queue_head_init(&tp->out_of_order_queue);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
+	INIT_LIST_HEAD(&tp->tsq_node);
 
 	icsk->icsk_rto = TCP_TIMEOUT_INIT;
 	tp->mdev = TCP_TIMEOUT_INIT;
@@ -1942,6 +2133,10 @@ void tcp_v4_destroy_sock(struct sock *sk)
 		tp->cookie_values = NULL;
 	}
 
+	/* TCP Fast Open */
+	tcp_free_fastopen_req(tp);
+	tcp_fastopen_release(sk);
+
 	percpu_counter_dec(&tcp_sockets_allocated);
 }
 
@@ -1968,6 +2163,7 @@ static void *listening_get_next(struct seq_file *seq, void *cur)
 	struct hlist_nulls_node *node;
 	struct sock *sk = cur;
 	struct inet_listen_hashbucket *ilb;
+	struct listen_sock *lopt;
 	struct tcp_iter_state *st = seq->private;
 	struct net *net = seq_file_net(seq);
 
@@ -1981,33 +2177,39 @@ static void *listening_get_next(struct seq_file *seq, void *cur)
 	ilb = &tcp_hashinfo.listening_hash[st->bucket];
 	++st->num;
 
+	/* The SYN table is walked under RCU, like the lockless lookups do.
+	 * A request that is moved to the accept queue meanwhile takes its
+	 * dl_next with it, so skip the requests that already have a child.
+	 */
 	if (st->state == TCP_SEQ_STATE_OPENREQ) {
 		struct request_sock *req = cur;
 
 		icsk = inet_csk(st->syn_wait_sk);
-		req = req->dl_next;
+		lopt = rcu_dereference(icsk->icsk_accept_queue.listen_opt);
+		req = rcu_dereference(req->dl_next);
 		while (1) {
 			while (req) {
-				if (req->rsk_ops->family == st->family) {
+				if (req->rsk_ops->family == st->family &&
+				    req->sk == NULL) {
 					cur = req;
 					goto out;
 				}
-				req = req->dl_next;
+				req = rcu_dereference(req->dl_next);
 			}
-			if (++st->sbucket >= icsk->icsk_accept_queue.listen_opt->nr_table_entries)
+			if (lopt == NULL || ++st->sbucket >= lopt->nr_table_entries)
 				break;
 get_req:
-			req = icsk->icsk_accept_queue.listen_opt->syn_table[st->sbucket];
+			req = lopt ? rcu_dereference(lopt->syn_table[st->sbucket]) : NULL;
 		}
 		sk	  = sk_next(st->syn_wait_sk);
 		st->state = TCP_SEQ_STATE_LISTENING;
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		rcu_read_unlock();
 	} else {
 		icsk = inet_csk(sk);
-		read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		rcu_read_lock();
 		if (reqsk_queue_len(&icsk->icsk_accept_queue))
 			goto start_req;
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		rcu_read_unlock();
 		sk = sk_next(sk);
 	}
 get_sk:
@@ -2017,16 +2219,17 @@ get_sk:
 			goto out;
 		}
 		icsk = inet_csk(sk);
-		read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		rcu_read_lock();
 		if (reqsk_queue_len(&icsk->icsk_accept_queue)) {
 start_req:
 			st->uid		= sock_i_uid(sk);
 			st->syn_wait_sk = sk;
 			st->state	= TCP_SEQ_STATE_OPENREQ;
 			st->sbucket	= 0;
+			lopt		= rcu_dereference(icsk->icsk_accept_queue.listen_opt);
 			goto get_req;
 		}
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		rcu_read_unlock();
 	}
 	spin_unlock_bh(&ilb->lock);
 	if (++st->bucket < INET_LHTABLE_SIZE) {
@@ -2220,10 +2423,8 @@ static void tcp_seq_stop(struct seq_file *seq, void *v)
 
 	switch (st->state) {
 	case TCP_SEQ_STATE_OPENREQ:
-		if (v) {
-			struct inet_connection_sock *icsk = inet_csk(st->syn_wait_sk);
-			read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
-		}
+		if (v)
+			rcu_read_unlock();
 	case TCP_SEQ_STATE_LISTENING:
 		if (v != SEQ_START_TOKEN)
 			spin_unlock_bh(&tcp_hashinfo.listening_hash[st->bucket].lock);
@@ -2473,12 +2674,12 @@ struct sk_buff **tcp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(tcp4_gro_receive);
 
-int tcp4_gro_complete(struct sk_buff *skb)
+int tcp4_gro_complete(struct sk_buff *skb, int thoff)
 {
 	struct iphdr *iph = ip_hdr(skb);
 	struct tcphdr *th = tcp_hdr(skb);
 
-	th->check = ~tcp_v4_check(skb->len - skb_transport_offset(skb),
+	th->check = ~tcp_v4_check(skb->len - thoff,
 				  iph->saddr, iph->daddr, 0);
 	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
 
@@ -2501,6 +2702,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
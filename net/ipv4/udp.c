@@ -104,6 +104,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include "udp_impl.h"
 
 struct udp_table udp_table __read_mostly;
@@ -134,12 +135,15 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net) &&
 		    sk2 != sk &&
 		    (bitmap || udp_sk(sk2)->udp_port_hash == num) &&
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -164,6 +168,7 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 	int res = 0;
 
 	spin_lock(&hslot2->lock);
@@ -172,6 +177,8 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 		    sk2 != sk &&
 		    (udp_sk(sk2)->udp_port_hash == num) &&
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -403,7 +410,8 @@ static struct sock *udp4_lib_lookup2(struct net *net,
 {
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 begin:
 	result = NULL;
@@ -414,8 +422,18 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
-			if (score == SCORE2_MAX)
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			} else if (score == SCORE2_MAX)
 				goto exact_match;
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -451,7 +469,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 	rcu_read_lock();
 	if (hslot->count > 10) {
@@ -471,8 +490,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 			if (hslot->count < hslot2->count)
 				goto begin;
 
-			result = udp4_lib_lookup2(net, INADDR_ANY, sport,
-						  daddr, hnum, dif,
+			result = udp4_lib_lookup2(net, saddr, sport,
+						  INADDR_ANY, hnum, dif,
 						  hslot2, slot2);
 		}
 		rcu_read_unlock();
@@ -487,6 +506,17 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -609,6 +639,15 @@ void __udp4_lib_err(struct sk_buff *skb, u32 info, struct udp_table *udptable)
 		break;
 	case ICMP_DEST_UNREACH:
 		if (code == ICMP_FRAG_NEEDED) { /* Path MTU discovery */
+			struct dst_entry *dst = sk_dst_get(sk);
+
+			/* The route of a connected socket is not refreshed
+			 * by the lookup, so hand it the new PMTU here.
+			 */
+			if (dst) {
+				dst->ops->update_pmtu(dst, info);
+				dst_release(dst);
+			}
 			if (inet->pmtudisc != IP_PMTUDISC_DONT) {
 				err = EMSGSIZE;
 				harderr = 1;
@@ -701,6 +740,39 @@ static void udp4_hwcsum_outgoing(struct sock *sk, struct sk_buff *skb,
 	}
 }
 
+/*
+ * Mark a datagram built for UDP_SEGMENT to be split into gso_size sized
+ * datagrams by udp4_ufo_fragment(), if it is larger than one segment.
+ */
+static int udp_set_gso(struct sock *sk, struct sk_buff *skb,
+		       unsigned int gso_size)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	struct udp_sock *up = udp_sk(sk);
+	unsigned int hlen = skb_network_header_len(skb) + sizeof(struct udphdr);
+	unsigned int datalen = up->len - sizeof(struct udphdr);
+
+	if (hlen + gso_size > inet->cork.fragsize)
+		return -EINVAL;
+	if (datalen > gso_size * UDP_MAX_SEGMENTS)
+		return -EINVAL;
+	if (IS_UDPLITE(sk) || sk->sk_no_check == UDP_CSUM_NOXMIT)
+		return -EINVAL;
+	/* Corked appends can still outgrow the skb */
+	if (skb_queue_len(&sk->sk_write_queue) != 1)
+		return -EMSGSIZE;
+	/* Segments need their checksum filled in one by one */
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		return -EIO;
+
+	if (datalen > gso_size) {
+		skb_shinfo(skb)->gso_size = gso_size;
+		skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(datalen, gso_size);
+	}
+	return 0;
+}
+
 /*
  * Push out all pending data as one UDP datagram. Socket is locked.
  */
@@ -728,6 +800,14 @@ static int udp_push_pending_frames(struct sock *sk)
 	uh->len = htons(up->len);
 	uh->check = 0;
 
+	if (inet->cork.gso_size) {
+		err = udp_set_gso(sk, skb, inet->cork.gso_size);
+		if (err) {
+			ip_flush_pending_frames(sk);
+			goto out;
+		}
+	}
+
 	if (is_udplite)  				 /*     UDP-Lite      */
 		csum  = udplite_csum_outgoing(sk, skb);
 
@@ -767,6 +847,35 @@ out:
 	return err;
 }
 
+/*
+ * Parse the SOL_UDP control messages of a send.  Returns 1 if there are
+ * others left for ip_cmsg_send().
+ */
+static int udp_cmsg_send(struct msghdr *msg, u16 *gso_size)
+{
+	struct cmsghdr *cmsg;
+	int need_ip = 0;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return -EINVAL;
+		if (cmsg->cmsg_level != SOL_UDP) {
+			need_ip = 1;
+			continue;
+		}
+		switch (cmsg->cmsg_type) {
+		case UDP_SEGMENT:
+			if (cmsg->cmsg_len != CMSG_LEN(sizeof(__u16)))
+				return -EINVAL;
+			*gso_size = *(__u16 *)CMSG_DATA(cmsg);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	return need_ip;
+}
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -796,6 +905,7 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	ipc.opt = NULL;
 	ipc.shtx.flags = 0;
+	ipc.gso_size = up->gso_size;
 
 	if (up->pending) {
 		/*
@@ -847,7 +957,9 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (err)
 		return err;
 	if (msg->msg_controllen) {
-		err = ip_cmsg_send(sock_net(sk), msg, &ipc);
+		err = udp_cmsg_send(msg, &ipc.gso_size);
+		if (err > 0)
+			err = ip_cmsg_send(sock_net(sk), msg, &ipc);
 		if (err)
 			return err;
 		if (ipc.opt)
@@ -857,6 +969,17 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (!ipc.opt)
 		ipc.opt = inet->opt;
 
+	/* A UDP_SEGMENT datagram must fit in the single skb that
+	 * ip_append_data() builds, 64KB less the IP header rounded
+	 * down to a multiple of 8.
+	 */
+	if (ipc.gso_size &&
+	    ulen > ((0xFFFF - sizeof(struct iphdr) -
+		     (ipc.opt ? ipc.opt->optlen : 0)) & ~7)) {
+		err = -EMSGSIZE;
+		goto out;
+	}
+
 	saddr = ipc.addr;
 	ipc.addr = faddr = daddr;
 
@@ -1258,7 +1381,14 @@ EXPORT_SYMBOL(udp_lib_unhash);
 
 static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
-	int rc = sock_queue_rcv_skb(sk, skb);
+	int rc;
+
+	if (inet_sk(sk)->inet_daddr) {
+		sock_rps_save_rxhash(sk, skb->rxhash);
+		sk_mark_napi_id(sk, skb);
+	}
+
+	rc = sock_queue_rcv_skb(sk, skb);
 
 	if (rc < 0) {
 		int is_udplite = IS_UDPLITE(sk);
@@ -1694,6 +1824,12 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		up->pcflag |= UDPLITE_RECV_CC;
 		break;
 
+	case UDP_SEGMENT:
+		if (val < 0 || val > USHORT_MAX)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
 	default:
 		err = -ENOPROTOOPT;
 		break;
@@ -1756,6 +1892,10 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->pcrlen;
 		break;
 
+	case UDP_SEGMENT:
+		val = up->gso_size;
+		break;
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1803,6 +1943,8 @@ unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	unsigned int mask = datagram_poll(file, sock, wait);
 	struct sock *sk = sock->sk;
 
+	sock_rps_record_flow(sk);
+
 	/* Check for false positives due to checksum errors */
 	if ((mask & POLLRDNORM) && !(file->f_flags & O_NONBLOCK) &&
 	    !(sk->sk_shutdown & RCV_SHUTDOWN) && !first_packet_length(sk))
@@ -2142,6 +2284,68 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Split a UDP_SEGMENT datagram into datagrams of gso_size payload bytes,
+ * each with its own UDP header.  IP headers are fixed up afterwards in
+ * inet_gso_segment().
+ */
+static struct sk_buff *udp4_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *seg;
+	const struct iphdr *iph;
+	struct udphdr *uh;
+	unsigned int mss;
+	unsigned int ulen;
+
+	mss = skb_shinfo(skb)->gso_size;
+	if (unlikely(skb->len <= sizeof(*uh) + mss))
+		goto out;
+
+	if (!pskb_may_pull(skb, sizeof(*uh)))
+		goto out;
+
+	if (skb_gso_ok(skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		int type = skb_shinfo(skb)->gso_type;
+
+		if (unlikely(type & ~(SKB_GSO_UDP_L4 | SKB_GSO_DODGY) ||
+			     !(type & SKB_GSO_UDP_L4)))
+			goto out;
+
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len - sizeof(*uh),
+							 mss);
+
+		segs = NULL;
+		goto out;
+	}
+
+	__skb_pull(skb, sizeof(*uh));
+
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		goto out;
+
+	for (seg = segs; seg; seg = seg->next) {
+		iph = ip_hdr(seg);
+		uh = udp_hdr(seg);
+		ulen = seg->len - skb_transport_offset(seg);
+
+		uh->len = htons(ulen);
+		uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, ulen,
+					       IPPROTO_UDP, 0);
+		if (seg->ip_summed != CHECKSUM_PARTIAL) {
+			uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+							   seg->csum));
+			if (uh->check == 0)
+				uh->check = CSUM_MANGLED_0;
+		}
+	}
+
+out:
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -2149,6 +2353,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return udp4_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
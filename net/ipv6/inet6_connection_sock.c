@@ -31,6 +31,9 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 {
 	const struct sock *sk2;
 	const struct hlist_node *node;
+	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	int uid = sock_i_uid((struct sock *)sk);
 
 	/* We must walk the whole port owner list in this case. -DaveM */
 	/*
@@ -42,8 +45,11 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if) &&
-		    (!sk->sk_reuse || !sk2->sk_reuse ||
+		    (!reuse || !sk2->sk_reuse ||
 		     sk2->sk_state == TCP_LISTEN) &&
+		    (!reuseport || !sk2->sk_reuseport ||
+		     (sk2->sk_state != TCP_TIME_WAIT &&
+		      uid != sock_i_uid((struct sock *)sk2))) &&
 		     ipv6_rcv_saddr_equal(sk, sk2))
 			break;
 	}
@@ -75,36 +81,45 @@ static u32 inet6_synq_hash(const struct in6_addr *raddr, const __be16 rport,
 	return c & (synq_hsize - 1);
 }
 
+/* See inet_csk_search_req() */
 struct request_sock *inet6_csk_search_req(const struct sock *sk,
-					  struct request_sock ***prevp,
 					  const __be16 rport,
 					  const struct in6_addr *raddr,
 					  const struct in6_addr *laddr,
 					  const int iif)
 {
-	const struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	struct request_sock *req, **prev;
-
-	for (prev = &lopt->syn_table[inet6_synq_hash(raddr, rport,
-						     lopt->hash_rnd,
-						     lopt->nr_table_entries)];
-	     (req = *prev) != NULL;
-	     prev = &req->dl_next) {
-		const struct inet6_request_sock *treq = inet6_rsk(req);
-
-		if (inet_rsk(req)->rmt_port == rport &&
-		    req->rsk_ops->family == AF_INET6 &&
-		    ipv6_addr_equal(&treq->rmt_addr, raddr) &&
-		    ipv6_addr_equal(&treq->loc_addr, laddr) &&
-		    (!treq->iif || treq->iif == iif)) {
-			WARN_ON(req->sk != NULL);
-			*prevp = prev;
-			return req;
+	const struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt;
+	struct request_sock *req = NULL;
+	unsigned int seq;
+	u32 hash;
+
+	rcu_read_lock();
+	lopt = rcu_dereference(queue->listen_opt);
+	if (lopt == NULL)
+		goto out;
+	hash = inet6_synq_hash(raddr, rport, lopt->hash_rnd,
+			       lopt->nr_table_entries);
+	do {
+		seq = read_seqbegin(&queue->syn_wait_lock);
+		for (req = rcu_dereference(lopt->syn_table[hash]); req != NULL;
+		     req = rcu_dereference(req->dl_next)) {
+			const struct inet6_request_sock *treq = inet6_rsk(req);
+
+			if (inet_rsk(req)->rmt_port == rport &&
+			    req->rsk_ops->family == AF_INET6 &&
+			    ipv6_addr_equal(&treq->rmt_addr, raddr) &&
+			    ipv6_addr_equal(&treq->loc_addr, laddr) &&
+			    (!treq->iif || treq->iif == iif)) {
+				if (!atomic_inc_not_zero(&req->rsk_refcnt))
+					req = NULL;
+				goto out;
+			}
 		}
-	}
-
-	return NULL;
+	} while (read_seqretry(&queue->syn_wait_lock, seq));
+out:
+	rcu_read_unlock();
+	return req;
 }
 
 EXPORT_SYMBOL_GPL(inet6_csk_search_req);
@@ -114,13 +129,23 @@ void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
 				    const unsigned long timeout)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
-	struct listen_sock *lopt = icsk->icsk_accept_queue.listen_opt;
-	const u32 h = inet6_synq_hash(&inet6_rsk(req)->rmt_addr,
-				      inet_rsk(req)->rmt_port,
-				      lopt->hash_rnd, lopt->nr_table_entries);
-
-	reqsk_queue_hash_req(&icsk->icsk_accept_queue, h, req, timeout);
-	inet_csk_reqsk_queue_added(sk, timeout);
+	struct listen_sock *lopt;
+	u32 h;
+
+	rcu_read_lock();
+	lopt = rcu_dereference(icsk->icsk_accept_queue.listen_opt);
+	if (lopt == NULL) {
+		reqsk_free(req);
+		goto out;
+	}
+	h = inet6_synq_hash(&inet6_rsk(req)->rmt_addr, inet_rsk(req)->rmt_port,
+			    lopt->hash_rnd, lopt->nr_table_entries);
+
+	if (reqsk_queue_hash_req(&icsk->icsk_accept_queue, lopt, h,
+				 req, timeout) == 0)
+		inet_csk_reset_keepalive_timer(sk, timeout);
+out:
+	rcu_read_unlock();
 }
 
 EXPORT_SYMBOL_GPL(inet6_csk_reqsk_queue_hash_add);
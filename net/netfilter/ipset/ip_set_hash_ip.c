@@ -0,0 +1,384 @@
+/* Copyright (C) 2010 Netfilter Core Team <coreteam@netfilter.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:ip type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_ahash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Netfilter Core Team <coreteam@netfilter.org>");
+MODULE_DESCRIPTION("hash:ip type of IP sets");
+MODULE_ALIAS("ip_set_hash:ip");
+
+/* The type specific data */
+struct hash_ip {
+	struct ip_set_hash h;	/* the generic hash */
+	u8 netmask;		/* netmask value for subnets to store */
+};
+
+#define HOST_MASK(family)	((family) == NFPROTO_IPV4 ? 32 : 128)
+
+static int
+hash_ip_adt(struct hash_ip *map, const void *e, enum ipset_adt adt)
+{
+	switch (adt) {
+	case IPSET_TEST:
+		return ahash_test(&map->h, e);
+	case IPSET_ADD:
+		return ahash_add(&map->h, e);
+	case IPSET_DEL:
+		return ahash_del(&map->h, e);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* IPv4 variant */
+
+struct hash_ip4_elem {
+	__be32 ip;
+};
+
+static int
+hash_ip4_data_list(struct sk_buff *skb, const void *data)
+{
+	const struct hash_ip4_elem *e = data;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
+static int
+hash_ip4_kadt(struct ip_set *set, const struct sk_buff *skb,
+	      enum ipset_adt adt, const struct ip_set_adt_opt *opt)
+{
+	struct hash_ip *map = set->data;
+	struct hash_ip4_elem e;
+
+	ip4addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &e.ip);
+	e.ip &= ip_set_netmask(map->netmask);
+
+	return hash_ip_adt(map, &e, adt);
+}
+
+static int
+hash_ip4_uadt(struct ip_set *set, struct nlattr *tb[],
+	      enum ipset_adt adt, u32 flags)
+{
+	struct hash_ip *map = set->data;
+	struct hash_ip4_elem e;
+	u32 ip, ip_to, hosts;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP]))
+		return -IPSET_ERR_PROTOCOL;
+
+	ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP], &ip);
+	if (ret)
+		return ret;
+
+	ip &= ip_set_hostmask(map->netmask);
+
+	if (adt == IPSET_TEST) {
+		e.ip = htonl(ip);
+		return hash_ip_adt(map, &e, adt);
+	}
+
+	if (tb[IPSET_ATTR_IP_TO]) {
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP_TO], &ip_to);
+		if (ret)
+			return ret;
+		if (ip > ip_to)
+			swap(ip, ip_to);
+	} else if (tb[IPSET_ATTR_CIDR]) {
+		u8 cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+
+		if (!cidr || cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+		ip &= ip_set_hostmask(cidr);
+		ip_to = ip | ~ip_set_hostmask(cidr);
+	} else
+		ip_to = ip;
+
+	ip &= ip_set_hostmask(map->netmask);
+	ip_to &= ip_set_hostmask(map->netmask);
+	hosts = 1U << (32 - map->netmask);
+
+	/* Don't even start when the range can't fit */
+	if (adt == IPSET_ADD &&
+	    (ip_to - ip) >> (32 - map->netmask) >= map->h.maxelem)
+		return -IPSET_ERR_HASH_FULL;
+
+	for (;;) {
+		e.ip = htonl(ip);
+		ret = hash_ip_adt(map, &e, adt);
+		if (ret && !ip_set_eexist(ret, flags))
+			return ret;
+		if (ip == ip_to)
+			break;
+		ip += hosts;
+	}
+	return 0;
+}
+
+/* IPv6 variant */
+
+struct hash_ip6_elem {
+	union nf_inet_addr ip;
+};
+
+static int
+hash_ip6_data_list(struct sk_buff *skb, const void *data)
+{
+	const struct hash_ip6_elem *e = data;
+
+	NLA_PUT_IPADDR6(skb, IPSET_ATTR_IP, &e->ip.in6);
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
+static int
+hash_ip6_kadt(struct ip_set *set, const struct sk_buff *skb,
+	      enum ipset_adt adt, const struct ip_set_adt_opt *opt)
+{
+	struct hash_ip *map = set->data;
+	struct hash_ip6_elem e;
+
+	ip6addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &e.ip.in6);
+	ip6_netmask(&e.ip, map->netmask);
+
+	return hash_ip_adt(map, &e, adt);
+}
+
+static int
+hash_ip6_uadt(struct ip_set *set, struct nlattr *tb[],
+	      enum ipset_adt adt, u32 flags)
+{
+	struct hash_ip *map = set->data;
+	struct hash_ip6_elem e;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] ||
+		     tb[IPSET_ATTR_IP_TO] ||
+		     tb[IPSET_ATTR_CIDR]))
+		return -IPSET_ERR_PROTOCOL;
+
+	ret = ip_set_get_ipaddr6(tb[IPSET_ATTR_IP], &e.ip);
+	if (ret)
+		return ret;
+
+	ip6_netmask(&e.ip, map->netmask);
+
+	return hash_ip_adt(map, &e, adt);
+}
+
+/* Common functions */
+
+static int
+hash_ip4_list(const struct ip_set *set, struct sk_buff *skb,
+	      struct netlink_callback *cb)
+{
+	const struct hash_ip *map = set->data;
+
+	return ahash_list(&map->h, skb, cb, hash_ip4_data_list);
+}
+
+static int
+hash_ip6_list(const struct ip_set *set, struct sk_buff *skb,
+	      struct netlink_callback *cb)
+{
+	const struct hash_ip *map = set->data;
+
+	return ahash_list(&map->h, skb, cb, hash_ip6_data_list);
+}
+
+static int
+hash_ip_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_ip *map = set->data;
+	struct nlattr *nested;
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	/* The ongoing dump holds a reference too */
+	if (ahash_head(&map->h, skb, sizeof(*map), set->ref - 1))
+		goto nla_put_failure;
+	if (map->netmask != HOST_MASK(set->family))
+		NLA_PUT_U8(skb, IPSET_ATTR_NETMASK, map->netmask);
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_ip_resize(struct ip_set *set)
+{
+	struct hash_ip *map = set->data;
+
+	return ahash_resize(set, &map->h);
+}
+
+static void
+hash_ip_flush(struct ip_set *set)
+{
+	struct hash_ip *map = set->data;
+
+	ahash_flush(&map->h);
+}
+
+static void
+hash_ip_destroy(struct ip_set *set)
+{
+	struct hash_ip *map = set->data;
+
+	ahash_destroy_table(map->h.table);
+	kfree(map);
+	set->data = NULL;
+}
+
+static bool
+hash_ip_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_ip *x = a->data;
+	const struct hash_ip *y = b->data;
+
+	/* Resizing changes htable_bits, so we ignore it */
+	return x->h.maxelem == y->h.maxelem &&
+	       x->netmask == y->netmask;
+}
+
+static const struct ip_set_type_variant hash_ip4_variant = {
+	.kadt	= hash_ip4_kadt,
+	.uadt	= hash_ip4_uadt,
+	.resize	= hash_ip_resize,
+	.destroy = hash_ip_destroy,
+	.flush	= hash_ip_flush,
+	.head	= hash_ip_head,
+	.list	= hash_ip4_list,
+	.same_set = hash_ip_same_set,
+};
+
+static const struct ip_set_type_variant hash_ip6_variant = {
+	.kadt	= hash_ip6_kadt,
+	.uadt	= hash_ip6_uadt,
+	.resize	= hash_ip_resize,
+	.destroy = hash_ip_destroy,
+	.flush	= hash_ip_flush,
+	.head	= hash_ip_head,
+	.list	= hash_ip6_list,
+	.same_set = hash_ip_same_set,
+};
+
+static int
+hash_ip_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	struct hash_ip *map;
+	u8 netmask;
+	int ret;
+
+	if (!(set->family == NFPROTO_IPV4 || set->family == NFPROTO_IPV6))
+		return -IPSET_ERR_INVALID_FAMILY;
+	netmask = HOST_MASK(set->family);
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	if (tb[IPSET_ATTR_NETMASK]) {
+		netmask = nla_get_u8(tb[IPSET_ATTR_NETMASK]);
+
+		if (!netmask || netmask > HOST_MASK(set->family))
+			return -IPSET_ERR_INVALID_NETMASK;
+	}
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+
+	map->netmask = netmask;
+	ret = ahash_init(&map->h, hashsize, maxelem,
+			 set->family == NFPROTO_IPV4
+				? sizeof(struct hash_ip4_elem)
+				: sizeof(struct hash_ip6_elem));
+	if (ret) {
+		kfree(map);
+		return ret;
+	}
+
+	set->data = map;
+	set->variant = set->family == NFPROTO_IPV4
+		? &hash_ip4_variant : &hash_ip6_variant;
+
+	pr_debug("create %s hashsize %u (%u) maxelem %u: %p(%p)\n",
+		 set->name, jhash_size(map->h.table->htable_bits),
+		 map->h.table->htable_bits, map->h.maxelem, set->data,
+		 map->h.table);
+
+	return 0;
+}
+
+static struct ip_set_type hash_ip_type __read_mostly = {
+	.name		= "hash:ip",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_UNSPEC,
+	.revision	= 0,
+	.create		= hash_ip_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+		[IPSET_ATTR_NETMASK]	= { .type = NLA_U8  },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_ip_init(void)
+{
+	return ip_set_type_register(&hash_ip_type);
+}
+
+static void __exit
+hash_ip_fini(void)
+{
+	ip_set_type_unregister(&hash_ip_type);
+}
+
+module_init(hash_ip_init);
+module_exit(hash_ip_fini);
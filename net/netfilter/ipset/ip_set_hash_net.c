@@ -0,0 +1,388 @@
+/* Copyright (C) 2010 Netfilter Core Team <coreteam@netfilter.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:net type */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_ahash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Netfilter Core Team <coreteam@netfilter.org>");
+MODULE_DESCRIPTION("hash:net type of IP sets");
+MODULE_ALIAS("ip_set_hash:net");
+
+#define HOST_MASK(family)	((family) == NFPROTO_IPV4 ? 32 : 128)
+
+/* The type specific data: the elements are stored with their prefix
+ * length, nets[] counts the elements per prefix length so that
+ * matching a packet has to look up the used prefix lengths only. */
+struct hash_net {
+	struct ip_set_hash h;	/* the generic hash */
+	u32 nets[HOST_MASK(NFPROTO_IPV6) + 1];
+};
+
+static int
+hash_net_adt(struct hash_net *map, const void *e, u8 cidr,
+	     enum ipset_adt adt)
+{
+	int ret;
+
+	switch (adt) {
+	case IPSET_TEST:
+		return ahash_test(&map->h, e);
+	case IPSET_ADD:
+		ret = ahash_add(&map->h, e);
+		if (ret == 0)
+			map->nets[cidr]++;
+		return ret;
+	case IPSET_DEL:
+		ret = ahash_del(&map->h, e);
+		if (ret == 0)
+			map->nets[cidr]--;
+		return ret;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* IPv4 variant */
+
+struct hash_net4_elem {
+	__be32 ip;
+	u8 cidr;
+	u8 padding[3];
+};
+
+static int
+hash_net4_data_list(struct sk_buff *skb, const void *data)
+{
+	const struct hash_net4_elem *e = data;
+
+	NLA_PUT_IPADDR4(skb, IPSET_ATTR_IP, e->ip);
+	NLA_PUT_U8(skb, IPSET_ATTR_CIDR, e->cidr);
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
+static int
+hash_net4_kadt(struct ip_set *set, const struct sk_buff *skb,
+	       enum ipset_adt adt, const struct ip_set_adt_opt *opt)
+{
+	struct hash_net *map = set->data;
+	struct hash_net4_elem e = { .cidr = 32 };
+	__be32 ip;
+	int cidr;
+
+	ip4addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &ip);
+
+	if (adt != IPSET_TEST) {
+		/* The kernel adds and deletes host addresses only */
+		e.ip = ip;
+		return hash_net_adt(map, &e, e.cidr, adt);
+	}
+
+	/* Most specific match first */
+	for (cidr = 32; cidr > 0; cidr--) {
+		if (!map->nets[cidr])
+			continue;
+		e.ip = ip & ip_set_netmask(cidr);
+		e.cidr = cidr;
+		if (ahash_test(&map->h, &e))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+hash_net4_uadt(struct ip_set *set, struct nlattr *tb[],
+	       enum ipset_adt adt, u32 flags)
+{
+	struct hash_net *map = set->data;
+	struct hash_net4_elem e = { .cidr = 32 };
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] || tb[IPSET_ATTR_IP_TO]))
+		return -IPSET_ERR_PROTOCOL;
+
+	ret = ip_set_get_ipaddr4(tb[IPSET_ATTR_IP], &e.ip);
+	if (ret)
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR]) {
+		e.cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (!e.cidr || e.cidr > 32)
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+	e.ip &= ip_set_netmask(e.cidr);
+
+	return hash_net_adt(map, &e, e.cidr, adt);
+}
+
+/* IPv6 variant */
+
+struct hash_net6_elem {
+	union nf_inet_addr ip;
+	u8 cidr;
+	u8 padding[3];
+};
+
+static int
+hash_net6_data_list(struct sk_buff *skb, const void *data)
+{
+	const struct hash_net6_elem *e = data;
+
+	NLA_PUT_IPADDR6(skb, IPSET_ATTR_IP, &e->ip.in6);
+	NLA_PUT_U8(skb, IPSET_ATTR_CIDR, e->cidr);
+	return 0;
+
+nla_put_failure:
+	return 1;
+}
+
+static int
+hash_net6_kadt(struct ip_set *set, const struct sk_buff *skb,
+	       enum ipset_adt adt, const struct ip_set_adt_opt *opt)
+{
+	struct hash_net *map = set->data;
+	struct hash_net6_elem e = { .cidr = 128 };
+	union nf_inet_addr ip;
+	int cidr;
+
+	ip6addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &ip.in6);
+
+	if (adt != IPSET_TEST) {
+		/* The kernel adds and deletes host addresses only */
+		e.ip = ip;
+		return hash_net_adt(map, &e, e.cidr, adt);
+	}
+
+	/* Most specific match first */
+	for (cidr = 128; cidr > 0; cidr--) {
+		if (!map->nets[cidr])
+			continue;
+		e.ip = ip;
+		ip6_netmask(&e.ip, cidr);
+		e.cidr = cidr;
+		if (ahash_test(&map->h, &e))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+hash_net6_uadt(struct ip_set *set, struct nlattr *tb[],
+	       enum ipset_adt adt, u32 flags)
+{
+	struct hash_net *map = set->data;
+	struct hash_net6_elem e = { .cidr = 128 };
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] || tb[IPSET_ATTR_IP_TO]))
+		return -IPSET_ERR_PROTOCOL;
+
+	ret = ip_set_get_ipaddr6(tb[IPSET_ATTR_IP], &e.ip);
+	if (ret)
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR]) {
+		e.cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (!e.cidr || e.cidr > 128)
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+	ip6_netmask(&e.ip, e.cidr);
+
+	return hash_net_adt(map, &e, e.cidr, adt);
+}
+
+/* Common functions */
+
+static int
+hash_net4_list(const struct ip_set *set, struct sk_buff *skb,
+	       struct netlink_callback *cb)
+{
+	const struct hash_net *map = set->data;
+
+	return ahash_list(&map->h, skb, cb, hash_net4_data_list);
+}
+
+static int
+hash_net6_list(const struct ip_set *set, struct sk_buff *skb,
+	       struct netlink_callback *cb)
+{
+	const struct hash_net *map = set->data;
+
+	return ahash_list(&map->h, skb, cb, hash_net6_data_list);
+}
+
+static int
+hash_net_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_net *map = set->data;
+	struct nlattr *nested;
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	/* The ongoing dump holds a reference too */
+	if (ahash_head(&map->h, skb, sizeof(*map), set->ref - 1))
+		goto nla_put_failure;
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int
+hash_net_resize(struct ip_set *set)
+{
+	struct hash_net *map = set->data;
+
+	return ahash_resize(set, &map->h);
+}
+
+static void
+hash_net_flush(struct ip_set *set)
+{
+	struct hash_net *map = set->data;
+
+	ahash_flush(&map->h);
+	memset(map->nets, 0, sizeof(map->nets));
+}
+
+static void
+hash_net_destroy(struct ip_set *set)
+{
+	struct hash_net *map = set->data;
+
+	ahash_destroy_table(map->h.table);
+	kfree(map);
+	set->data = NULL;
+}
+
+static bool
+hash_net_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_net *x = a->data;
+	const struct hash_net *y = b->data;
+
+	/* Resizing changes htable_bits, so we ignore it */
+	return x->h.maxelem == y->h.maxelem;
+}
+
+static const struct ip_set_type_variant hash_net4_variant = {
+	.kadt	= hash_net4_kadt,
+	.uadt	= hash_net4_uadt,
+	.resize	= hash_net_resize,
+	.destroy = hash_net_destroy,
+	.flush	= hash_net_flush,
+	.head	= hash_net_head,
+	.list	= hash_net4_list,
+	.same_set = hash_net_same_set,
+};
+
+static const struct ip_set_type_variant hash_net6_variant = {
+	.kadt	= hash_net6_kadt,
+	.uadt	= hash_net6_uadt,
+	.resize	= hash_net_resize,
+	.destroy = hash_net_destroy,
+	.flush	= hash_net_flush,
+	.head	= hash_net_head,
+	.list	= hash_net6_list,
+	.same_set = hash_net_same_set,
+};
+
+static int
+hash_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	struct hash_net *map;
+	int ret;
+
+	if (!(set->family == NFPROTO_IPV4 || set->family == NFPROTO_IPV6))
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_HASHSIZE])
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+
+	ret = ahash_init(&map->h, hashsize, maxelem,
+			 set->family == NFPROTO_IPV4
+				? sizeof(struct hash_net4_elem)
+				: sizeof(struct hash_net6_elem));
+	if (ret) {
+		kfree(map);
+		return ret;
+	}
+
+	set->data = map;
+	set->variant = set->family == NFPROTO_IPV4
+		? &hash_net4_variant : &hash_net6_variant;
+
+	pr_debug("create %s hashsize %u (%u) maxelem %u: %p(%p)\n",
+		 set->name, jhash_size(map->h.table->htable_bits),
+		 map->h.table->htable_bits, map->h.maxelem, set->data,
+		 map->h.table);
+
+	return 0;
+}
+
+static struct ip_set_type hash_net_type __read_mostly = {
+	.name		= "hash:net",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_UNSPEC,
+	.revision	= 0,
+	.create		= hash_net_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_net_init(void)
+{
+	return ip_set_type_register(&hash_net_type);
+}
+
+static void __exit
+hash_net_fini(void)
+{
+	ip_set_type_unregister(&hash_net_type);
+}
+
+module_init(hash_net_init);
+module_exit(hash_net_fini);
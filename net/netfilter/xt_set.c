@@ -0,0 +1,212 @@
+/* Copyright (C) 2010 Netfilter Core Team <coreteam@netfilter.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module which implements the set match and SET target
+ * for netfilter/iptables. */
+
+#include <linux/module.h>
+#include <linux/skbuff.h>
+
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Netfilter Core Team <coreteam@netfilter.org>");
+MODULE_DESCRIPTION("Xtables: IP set match and target module");
+MODULE_ALIAS("xt_SET");
+MODULE_ALIAS("ipt_set");
+MODULE_ALIAS("ip6t_set");
+MODULE_ALIAS("ipt_SET");
+MODULE_ALIAS("ip6t_SET");
+
+#define ADT_OPT(n, f, d, fs)		\
+struct ip_set_adt_opt n = {		\
+	.family	= f,			\
+	.dim = d,			\
+	.flags = fs,			\
+}
+
+static inline bool
+match_set(ip_set_id_t index, const struct sk_buff *skb,
+	  const struct ip_set_adt_opt *opt, bool inv)
+{
+	if (ip_set_test(index, skb, opt))
+		inv = !inv;
+	return inv;
+}
+
+/* Look up the set by name and check the dimension of the request */
+static bool
+set_get_info(struct xt_set_info *info, const char *what)
+{
+	struct ip_set *set;
+
+	info->name[IPSET_MAXNAMELEN - 1] = '\0';
+	info->index = ip_set_get_byname(info->name, &set);
+	if (info->index == IPSET_INVALID_ID) {
+		pr_warning("Cannot find %s set %s\n", what, info->name);
+		return false;
+	}
+	if (info->dim != IPSET_DIM_ONE) {
+		pr_warning("Protocol error: set %s dimension is %u, "
+			   "only one dimensional sets are supported\n",
+			   info->name, info->dim);
+		ip_set_put_byindex(info->index);
+		return false;
+	}
+	return true;
+}
+
+static bool
+set_match(const struct sk_buff *skb, const struct xt_match_param *par)
+{
+	const struct xt_set_info_match *info = par->matchinfo;
+	ADT_OPT(opt, par->family, info->match_set.dim,
+		info->match_set.flags);
+
+	return match_set(info->match_set.index, skb, &opt,
+			 info->match_set.flags & IPSET_INV_MATCH);
+}
+
+static bool
+set_match_checkentry(const struct xt_mtchk_param *par)
+{
+	struct xt_set_info_match *info = par->matchinfo;
+
+	return set_get_info(&info->match_set, "match");
+}
+
+static void
+set_match_destroy(const struct xt_mtdtor_param *par)
+{
+	struct xt_set_info_match *info = par->matchinfo;
+
+	ip_set_put_byindex(info->match_set.index);
+}
+
+static unsigned int
+set_target(struct sk_buff *skb, const struct xt_target_param *par)
+{
+	const struct xt_set_info_target *info = par->targinfo;
+	ADT_OPT(add_opt, par->family, info->add_set.dim,
+		info->add_set.flags);
+	ADT_OPT(del_opt, par->family, info->del_set.dim,
+		info->del_set.flags);
+
+	if (info->add_set.index != IPSET_INVALID_ID)
+		ip_set_add(info->add_set.index, skb, &add_opt);
+	if (info->del_set.index != IPSET_INVALID_ID)
+		ip_set_del(info->del_set.index, skb, &del_opt);
+
+	return XT_CONTINUE;
+}
+
+static bool
+set_target_checkentry(const struct xt_tgchk_param *par)
+{
+	struct xt_set_info_target *info = par->targinfo;
+
+	if (info->add_set.name[0] == '\0')
+		info->add_set.index = IPSET_INVALID_ID;
+	else if (!set_get_info(&info->add_set, "add"))
+		return false;
+
+	if (info->del_set.name[0] == '\0')
+		info->del_set.index = IPSET_INVALID_ID;
+	else if (!set_get_info(&info->del_set, "del")) {
+		if (info->add_set.index != IPSET_INVALID_ID)
+			ip_set_put_byindex(info->add_set.index);
+		return false;
+	}
+
+	if (info->add_set.index == IPSET_INVALID_ID &&
+	    info->del_set.index == IPSET_INVALID_ID) {
+		pr_warning("SET target: no set specified\n");
+		return false;
+	}
+	return true;
+}
+
+static void
+set_target_destroy(const struct xt_tgdtor_param *par)
+{
+	const struct xt_set_info_target *info = par->targinfo;
+
+	if (info->add_set.index != IPSET_INVALID_ID)
+		ip_set_put_byindex(info->add_set.index);
+	if (info->del_set.index != IPSET_INVALID_ID)
+		ip_set_put_byindex(info->del_set.index);
+}
+
+static struct xt_match set_matches[] __read_mostly = {
+	{
+		.name		= "set",
+		.family		= NFPROTO_IPV4,
+		.revision	= 0,
+		.match		= set_match,
+		.matchsize	= sizeof(struct xt_set_info_match),
+		.checkentry	= set_match_checkentry,
+		.destroy	= set_match_destroy,
+		.me		= THIS_MODULE
+	},
+	{
+		.name		= "set",
+		.family		= NFPROTO_IPV6,
+		.revision	= 0,
+		.match		= set_match,
+		.matchsize	= sizeof(struct xt_set_info_match),
+		.checkentry	= set_match_checkentry,
+		.destroy	= set_match_destroy,
+		.me		= THIS_MODULE
+	},
+};
+
+static struct xt_target set_targets[] __read_mostly = {
+	{
+		.name		= "SET",
+		.revision	= 0,
+		.family		= NFPROTO_IPV4,
+		.target		= set_target,
+		.targetsize	= sizeof(struct xt_set_info_target),
+		.checkentry	= set_target_checkentry,
+		.destroy	= set_target_destroy,
+		.me		= THIS_MODULE
+	},
+	{
+		.name		= "SET",
+		.revision	= 0,
+		.family		= NFPROTO_IPV6,
+		.target		= set_target,
+		.targetsize	= sizeof(struct xt_set_info_target),
+		.checkentry	= set_target_checkentry,
+		.destroy	= set_target_destroy,
+		.me		= THIS_MODULE
+	},
+};
+
+static int __init xt_set_init(void)
+{
+	int ret = xt_register_matches(set_matches, ARRAY_SIZE(set_matches));
+
+	if (!ret) {
+		ret = xt_register_targets(set_targets,
+					  ARRAY_SIZE(set_targets));
+		if (ret)
+			xt_unregister_matches(set_matches,
+					      ARRAY_SIZE(set_matches));
+	}
+	return ret;
+}
+
+static void __exit xt_set_fini(void)
+{
+	xt_unregister_matches(set_matches, ARRAY_SIZE(set_matches));
+	xt_unregister_targets(set_targets, ARRAY_SIZE(set_targets));
+}
+
+module_init(xt_set_init);
+module_exit(xt_set_fini);
@@ -1166,6 +1166,7 @@ static int tc_fill_qdisc(struct sk_buff *skb, struct Qdisc *q, u32 clid,
 	NLA_PUT_STRING(skb, TCA_KIND, q->ops->id);
 	if (q->ops->dump && q->ops->dump(q, skb) < 0)
 		goto nla_put_failure;
+	qdisc_sync_nolock_stats(q);
 	q->qstats.qlen = q->q.qlen;
 
 	if (q->stab && qdisc_dump_stab(skb, q->stab) < 0)
@@ -35,13 +35,32 @@
  * - enqueue, dequeue are serialized via qdisc root lock
  * - ingress filtering is also serialized via qdisc root lock
  * - updates to tree and tree walking are only done under the rtnl mutex.
+ *
+ * TCQ_F_NOLOCK qdiscs are the exception: they are enqueued to without any
+ * lock, and their dequeue side is serialized by __QDISC_STATE_RUNNING only.
  */
 
+static inline void qdisc_qlen_inc(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		atomic_inc(&q->nolock_qlen);
+	else
+		q->q.qlen++;
+}
+
+static inline void qdisc_qlen_dec(struct Qdisc *q)
+{
+	if (q->flags & TCQ_F_NOLOCK)
+		atomic_dec(&q->nolock_qlen);
+	else
+		q->q.qlen--;
+}
+
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	q->gso_skb = skb;
 	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	qdisc_qlen_inc(q);	/* it's still part of the queue */
 	__netif_schedule(q);
 
 	return 0;
@@ -57,10 +76,9 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-		if (!netif_tx_queue_stopped(txq) &&
-		    !netif_tx_queue_frozen(txq)) {
+		if (!netif_xmit_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			qdisc_qlen_dec(q);
 		} else
 			skb = NULL;
 	} else {
@@ -103,7 +121,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 /*
  * Transmit one skb, and handle the return status as required. Holding the
  * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
- * function.
+ * function. @root_lock is NULL for TCQ_F_NOLOCK qdiscs.
  *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
@@ -116,15 +134,17 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	int ret = NETDEV_TX_BUSY;
 
 	/* And release qdisc */
-	spin_unlock(root_lock);
+	if (root_lock)
+		spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) && !netif_tx_queue_frozen(txq))
+	if (!netif_xmit_frozen_or_stopped(txq))
 		ret = dev_hard_start_xmit(skb, dev, txq);
 
 	HARD_TX_UNLOCK(dev, txq);
 
-	spin_lock(root_lock);
+	if (root_lock)
+		spin_lock(root_lock);
 
 	if (dev_xmit_complete(ret)) {
 		/* Driver sent out skb successfully or skb was consumed */
@@ -136,20 +156,20 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		/* Driver returned NETDEV_TX_BUSY - requeue skb */
 		if (unlikely (ret != NETDEV_TX_BUSY && net_ratelimit()))
 			printk(KERN_WARNING "BUG %s code %d qlen %d\n",
-			       dev->name, ret, q->q.qlen);
+			       dev->name, ret, qdisc_qlen(q));
 
 		ret = dev_requeue_skb(skb, q);
 	}
 
-	if (ret && (netif_tx_queue_stopped(txq) ||
-		    netif_tx_queue_frozen(txq)))
+	if (ret && netif_xmit_frozen_or_stopped(txq))
 		ret = 0;
 
 	return ret;
 }
 
 /*
- * NOTE: Called under qdisc_lock(q) with locally disabled BH.
+ * NOTE: Called under qdisc_lock(q) with locally disabled BH, or just with
+ * locally disabled BH for TCQ_F_NOLOCK qdiscs.
  *
  * __QDISC_STATE_RUNNING guarantees only one CPU can process
  * this qdisc at a time. qdisc_lock(q) serializes queue accesses for
@@ -179,7 +199,7 @@ static inline int qdisc_restart(struct Qdisc *q)
 	if (unlikely(!skb))
 		return 0;
 
-	root_lock = qdisc_lock(q);
+	root_lock = (q->flags & TCQ_F_NOLOCK) ? NULL : qdisc_lock(q);
 	dev = qdisc_dev(q);
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
@@ -202,7 +222,7 @@ void __qdisc_run(struct Qdisc *q)
 		}
 	}
 
-	clear_bit(__QDISC_STATE_RUNNING, &q->state);
+	qdisc_run_end(q);
 }
 
 unsigned long dev_trans_start(struct net_device *dev)
@@ -520,6 +540,151 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.owner		=	THIS_MODULE,
 };
 
+/*
+ * Lockless pfifo_fast, the default qdisc of device transmit queues.
+ *
+ * Senders push onto a per-band stack with cmpxchg() and never contend
+ * with the dequeuer. The CPU owning __QDISC_STATE_RUNNING takes over a
+ * whole stack at once, reversing it into a private FIFO, and dequeues
+ * from there. Queue length, backlog and drops live in the nolock_*
+ * counters of the Qdisc, byte and packet counts are taken at dequeue.
+ */
+struct pfifo_fast_nolock_priv {
+	struct sk_buff *head[PFIFO_FAST_BANDS];	/* owned by the dequeuer */
+	struct sk_buff *incoming[PFIFO_FAST_BANDS] ____cacheline_aligned_in_smp;
+};
+
+static int pfifo_fast_nolock_enqueue(struct sk_buff *skb, struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+	struct sk_buff **incoming = &priv->incoming[band];
+	struct sk_buff *first;
+
+	if (atomic_inc_return(&qdisc->nolock_qlen) >
+	    qdisc_dev(qdisc)->tx_queue_len) {
+		atomic_dec(&qdisc->nolock_qlen);
+		atomic_inc(&qdisc->nolock_drops);
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
+	}
+	atomic_add(qdisc_pkt_len(skb), &qdisc->nolock_backlog);
+
+	do {
+		first = ACCESS_ONCE(*incoming);
+		skb->next = first;
+	} while (cmpxchg(incoming, first, skb) != first);
+
+	return NET_XMIT_SUCCESS;
+}
+
+/* Refill the FIFO of @band from the senders' stack once it ran dry */
+static struct sk_buff *
+pfifo_fast_nolock_head(struct pfifo_fast_nolock_priv *priv, int band)
+{
+	struct sk_buff *skb = priv->head[band];
+
+	if (!skb && ACCESS_ONCE(priv->incoming[band])) {
+		struct sk_buff *list = xchg(&priv->incoming[band], NULL);
+
+		while (list) {
+			struct sk_buff *next = list->next;
+
+			list->next = skb;
+			skb = list;
+			list = next;
+		}
+		priv->head[band] = skb;
+	}
+
+	return skb;
+}
+
+static struct sk_buff *pfifo_fast_nolock_dequeue(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct sk_buff *skb = pfifo_fast_nolock_head(priv, band);
+
+		if (skb) {
+			priv->head[band] = skb->next;
+			skb->next = NULL;
+
+			atomic_dec(&qdisc->nolock_qlen);
+			atomic_sub(qdisc_pkt_len(skb), &qdisc->nolock_backlog);
+			__qdisc_update_bstats(qdisc, qdisc_pkt_len(skb));
+			return skb;
+		}
+	}
+
+	return NULL;
+}
+
+static struct sk_buff *pfifo_fast_nolock_peek(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct sk_buff *skb = pfifo_fast_nolock_head(priv, band);
+
+		if (skb)
+			return skb;
+	}
+
+	return NULL;
+}
+
+static void pfifo_fast_nolock_purge(struct Qdisc *qdisc, struct sk_buff *skb)
+{
+	while (skb) {
+		struct sk_buff *next = skb->next;
+
+		atomic_dec(&qdisc->nolock_qlen);
+		atomic_sub(qdisc_pkt_len(skb), &qdisc->nolock_backlog);
+		skb->next = NULL;
+		kfree_skb(skb);
+		skb = next;
+	}
+}
+
+/*
+ * Must not race with the dequeuer. Senders may still be enqueueing, so
+ * only account for what is actually freed.
+ */
+static void pfifo_fast_nolock_reset(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_nolock_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		pfifo_fast_nolock_purge(qdisc, priv->head[band]);
+		priv->head[band] = NULL;
+		pfifo_fast_nolock_purge(qdisc,
+					xchg(&priv->incoming[band], NULL));
+	}
+}
+
+static int pfifo_fast_nolock_init(struct Qdisc *qdisc, struct nlattr *opt)
+{
+	qdisc->flags |= TCQ_F_NOLOCK;
+	return 0;
+}
+
+struct Qdisc_ops pfifo_fast_nolock_ops __read_mostly = {
+	.id		=	"pfifo_fast",
+	.priv_size	=	sizeof(struct pfifo_fast_nolock_priv),
+	.enqueue	=	pfifo_fast_nolock_enqueue,
+	.dequeue	=	pfifo_fast_nolock_dequeue,
+	.peek		=	pfifo_fast_nolock_peek,
+	.init		=	pfifo_fast_nolock_init,
+	.reset		=	pfifo_fast_nolock_reset,
+	.dump		=	pfifo_fast_dump,
+	.owner		=	THIS_MODULE,
+};
+
 struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 			  struct Qdisc_ops *ops)
 {
@@ -573,7 +738,7 @@ errout:
 }
 EXPORT_SYMBOL(qdisc_create_dflt);
 
-/* Under qdisc_lock(qdisc) and BH! */
+/* Under qdisc_lock(qdisc) and BH! A TCQ_F_NOLOCK qdisc must not be running */
 
 void qdisc_reset(struct Qdisc *qdisc)
 {
@@ -585,7 +750,10 @@ void qdisc_reset(struct Qdisc *qdisc)
 	if (qdisc->gso_skb) {
 		kfree_skb(qdisc->gso_skb);
 		qdisc->gso_skb = NULL;
-		qdisc->q.qlen = 0;
+		if (qdisc->flags & TCQ_F_NOLOCK)
+			atomic_dec(&qdisc->nolock_qlen);
+		else
+			qdisc->q.qlen = 0;
 	}
 }
 EXPORT_SYMBOL(qdisc_reset);
@@ -650,7 +818,7 @@ static void attach_one_default_qdisc(struct net_device *dev,
 
 	if (dev->tx_queue_len) {
 		qdisc = qdisc_create_dflt(dev, dev_queue,
-					  &pfifo_fast_ops, TC_H_ROOT);
+					  &pfifo_fast_nolock_ops, TC_H_ROOT);
 		if (!qdisc) {
 			printk(KERN_INFO "%s: activation failed\n", dev->name);
 			return;
@@ -743,8 +911,23 @@ static void dev_deactivate_queue(struct net_device *dev,
 			set_bit(__QDISC_STATE_DEACTIVATED, &qdisc->state);
 
 		rcu_assign_pointer(dev_queue->qdisc, qdisc_default);
-		qdisc_reset(qdisc);
+		/* Lockless ones are reset once nobody can be running them */
+		if (!(qdisc->flags & TCQ_F_NOLOCK))
+			qdisc_reset(qdisc);
+
+		spin_unlock_bh(qdisc_lock(qdisc));
+	}
+}
+
+static void dev_reset_nolock_queue(struct net_device *dev,
+				   struct netdev_queue *dev_queue,
+				   void *_unused)
+{
+	struct Qdisc *qdisc = dev_queue->qdisc_sleeping;
 
+	if (qdisc && (qdisc->flags & TCQ_F_NOLOCK)) {
+		spin_lock_bh(qdisc_lock(qdisc));
+		qdisc_reset(qdisc);
 		spin_unlock_bh(qdisc_lock(qdisc));
 	}
 }
@@ -783,12 +966,16 @@ void dev_deactivate(struct net_device *dev)
 
 	dev_watchdog_down(dev);
 
-	/* Wait for outstanding qdisc-less dev_queue_xmit calls. */
-	synchronize_rcu();
+	/* Wait for outstanding qdisc-less and TCQ_F_NOLOCK dev_queue_xmit
+	 * calls, which only hold rcu_read_lock_bh().
+	 */
+	synchronize_rcu_bh();
 
 	/* Wait for outstanding qdisc_run calls. */
 	while (some_qdisc_is_busy(dev))
 		yield();
+
+	netdev_for_each_tx_queue(dev, dev_reset_nolock_queue, NULL);
 }
 
 static void dev_init_scheduler_queue(struct net_device *dev,